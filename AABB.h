@@ -0,0 +1,53 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <glm/glm.hpp>
+#include <limits>
+
+class AABB {
+public:
+    glm::vec3 min;
+    glm::vec3 max;
+
+    // starts out empty so the first expand() snaps to the point
+    AABB() :
+        min(glm::vec3( std::numeric_limits<float>::max())),
+        max(glm::vec3(-std::numeric_limits<float>::max())) {}
+
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    bool contains(const glm::vec3& point) const {
+        return point.x >= min.x && point.x <= max.x &&
+               point.y >= min.y && point.y <= max.y &&
+               point.z >= min.z && point.z <= max.z;
+    }
+
+    bool intersects(const AABB& other) const {
+        return min.x <= other.max.x && max.x >= other.min.x &&
+               min.y <= other.max.y && max.y >= other.min.y &&
+               min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+
+    // 0 inside
+    float distance(const glm::vec3& point) const {
+        return glm::length(point - glm::clamp(point, min, max));
+    }
+    glm::vec3 extents() const { return (max - min) * 0.5f; }
+};
+#endif
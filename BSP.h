@@ -0,0 +1,190 @@
+#ifndef BSP_H
+#define BSP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+
+/*
+ * Runtime side of the offline level compiler (see BSPCompiler.h and
+ * bsp_compiler.cpp). The tree splits space along wall planes; every leaf is
+ * a convex pocket of empty space with a precomputed row of visible leaves and
+ * a row of visible walls, so per-frame visibility is a leaf lookup followed by
+ * a bitset scan. Walls lying on a node's plane are kept on that node, which
+ * lets the same tree answer "which walls can this sphere touch" for collision.
+ */
+
+const char BSP_MAGIC[4] = { 'B', 'S', 'P', 'V' };
+const uint32_t BSP_VERSION = 2;
+
+struct BSPNode {
+    float plane[4];     // normal.xyz, d; front is where dot(normal, p) + d >= 0
+    int32_t front;      // >= 0 node index, < 0 leaf ~index
+    int32_t back;
+    uint32_t firstWall; // range into BSPTree::nodeWalls
+    uint32_t wallCount;
+};
+
+class BSPTree {
+public:
+    std::vector<BSPNode> nodes;
+    std::vector<uint32_t> nodeWalls;
+    std::vector<AABB> leafBounds;
+    uint32_t wallCount = 0;
+    // LevelDesc::geometryHash() of the level this was compiled from
+    uint64_t levelHash = 0;
+
+    // leafCount rows of leafRowBytes() bytes
+    std::vector<uint8_t> leafVisibility;
+    // leafCount rows of wallRowBytes() bytes
+    std::vector<uint8_t> wallVisibility;
+
+    static int leafChild(int leaf) { return ~leaf; }
+    static bool isLeaf(int child) { return child < 0; }
+
+    size_t leafCount() const { return leafBounds.size(); }
+    size_t leafRowBytes() const { return (leafCount() + 7) / 8; }
+    size_t wallRowBytes() const { return (wallCount + 7) / 8; }
+
+    bool empty() const { return leafBounds.empty(); }
+
+    int findLeaf(const glm::vec3& point) const {
+        if(nodes.empty()) return empty() ? -1 : 0;
+        int child = 0;
+        while(!isLeaf(child)) {
+            const BSPNode& node = nodes[child];
+            child = distance(node, point) >= 0 ? node.front : node.back;
+        }
+        return ~child;
+    }
+
+    bool isLeafVisible(int from, int to) const {
+        if(from < 0 || to < 0) return true;
+        const uint8_t* row = &leafVisibility[from * leafRowBytes()];
+        return row[to >> 3] & (1 << (to & 7));
+    }
+
+    // bitset of walls potentially visible from the leaf around point
+    const uint8_t* wallRow(const glm::vec3& point) const {
+        int leaf = findLeaf(point);
+        if(leaf < 0) return nullptr;
+        return &wallVisibility[leaf * wallRowBytes()];
+    }
+
+    // appends the walls potentially visible from the leaf around point
+    void visibleWalls(const glm::vec3& point, std::vector<int>& out) const {
+        const uint8_t* row = wallRow(point);
+        if(!row) return;
+        for(size_t byte = 0; byte < wallRowBytes(); byte++) {
+            uint8_t bits = row[byte];
+            while(bits) {
+                int bit = __builtin_ctz(bits);
+                out.push_back((int)(byte * 8 + bit));
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    // collision broadphase: walls whose plane the sphere straddles somewhere in the tree
+    void queryWalls(const glm::vec3& center, float radius, std::vector<int>& out) const {
+        out.clear();
+        if(nodes.empty()) return;
+        if(seen.size() != wallCount) seen.assign(wallCount, false);
+
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty()) {
+            const BSPNode& node = nodes[stack.back()];
+            stack.pop_back();
+
+            float d = distance(node, center);
+            if(d > -radius && d < radius) {
+                for(uint32_t i = 0; i < node.wallCount; i++) {
+                    uint32_t w = nodeWalls[node.firstWall + i];
+                    if(seen[w]) continue;
+                    seen[w] = true;
+                    out.push_back((int)w);
+                }
+            }
+            if(d > -radius && !isLeaf(node.front)) stack.push_back(node.front);
+            if(d <  radius && !isLeaf(node.back))  stack.push_back(node.back);
+        }
+        for(int w : out) seen[w] = false;
+    }
+
+    bool load(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if(!file) return false;
+
+        char magic[4];
+        uint32_t header[7];
+        bool ok = fread(magic, 1, 4, file) == 4
+               && memcmp(magic, BSP_MAGIC, 4) == 0
+               && fread(header, sizeof(uint32_t), 7, file) == 7
+               && header[0] == BSP_VERSION;
+        if(ok) {
+            nodes.resize(header[1]);
+            leafBounds.resize(header[2]);
+            wallCount = header[3];
+            nodeWalls.resize(header[4]);
+            levelHash = header[5] | (uint64_t)header[6] << 32;
+            leafVisibility.resize(leafCount() * leafRowBytes());
+            wallVisibility.resize(leafCount() * wallRowBytes());
+
+            std::vector<float> bounds(leafCount() * 6);
+            ok = readAll(file, nodes) && readAll(file, nodeWalls) && readAll(file, bounds)
+              && readAll(file, leafVisibility) && readAll(file, wallVisibility);
+            for(size_t i = 0; ok && i < leafCount(); i++) {
+                leafBounds[i] = AABB(glm::vec3(bounds[i * 6 + 0], bounds[i * 6 + 1], bounds[i * 6 + 2]),
+                                     glm::vec3(bounds[i * 6 + 3], bounds[i * 6 + 4], bounds[i * 6 + 5]));
+            }
+        }
+        fclose(file);
+        if(!ok) {
+            std::cout << "ERROR::BSP::INVALID_FILE " << path << std::endl;
+            *this = BSPTree();
+        }
+        return ok;
+    }
+
+    bool save(const char* path) const {
+        FILE* file = fopen(path, "wb");
+        if(!file) return false;
+
+        uint32_t header[7] = { BSP_VERSION, (uint32_t)nodes.size(), (uint32_t)leafCount(), wallCount, (uint32_t)nodeWalls.size(),
+                               (uint32_t)levelHash, (uint32_t)(levelHash >> 32) };
+        std::vector<float> bounds;
+        for(auto& b : leafBounds) {
+            bounds.insert(bounds.end(), { b.min.x, b.min.y, b.min.z, b.max.x, b.max.y, b.max.z });
+        }
+        bool ok = fwrite(BSP_MAGIC, 1, 4, file) == 4
+               && fwrite(header, sizeof(uint32_t), 7, file) == 7
+               && writeAll(file, nodes) && writeAll(file, nodeWalls) && writeAll(file, bounds)
+               && writeAll(file, leafVisibility) && writeAll(file, wallVisibility);
+        fclose(file);
+        return ok;
+    }
+
+private:
+    mutable std::vector<bool> seen;
+    mutable std::vector<int> stack;
+
+    static float distance(const BSPNode& node, const glm::vec3& p) {
+        return node.plane[0] * p.x + node.plane[1] * p.y + node.plane[2] * p.z + node.plane[3];
+    }
+
+    template<typename T>
+    static bool readAll(FILE* file, std::vector<T>& v) {
+        return fread(v.data(), sizeof(T), v.size(), file) == v.size();
+    }
+
+    template<typename T>
+    static bool writeAll(FILE* file, const std::vector<T>& v) {
+        return fwrite(v.data(), sizeof(T), v.size(), file) == v.size();
+    }
+};
+#endif
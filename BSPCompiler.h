@@ -0,0 +1,448 @@
+#ifndef BSP_COMPILER_H
+#define BSP_COMPILER_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "BSP.h"
+#include "Frustum.h"
+#include "Level.h"
+#include "Plane.h"
+
+/*
+ * Offline half of the BSP: builds the tree from the level's wall quads and
+ * fills in the visibility rows. Every node's plane, cut to the node's region
+ * and split into the leaves on either side, is a portal between leaves
+ * wherever the node's walls don't cover it. Visibility flows out of each leaf
+ * through those portals, clipping every further portal to what the ones
+ * before it can see through (the anti-penumbra), so nothing a point in the
+ * leaf could see is left out. Walls are carried along as the faces they
+ * cover and clipped the same way.
+ *
+ * Hint quads (the level's portals) split space like walls do but never block
+ * sight or collide. Without them an open-topped room shares one leaf with the
+ * sky above it and that leaf sees the whole level.
+ */
+class BSPCompiler {
+public:
+    BSPTree compile(const std::vector<WallDesc>& walls, const std::vector<PortalDesc>& hints) {
+        tree = BSPTree();
+        tree.wallCount = (uint32_t)walls.size();
+        quads.clear();
+
+        std::vector<Fragment> fragments;
+        for(size_t i = 0; i < walls.size(); i++) {
+            auto points = quadPoints(walls[i].p1, walls[i].p2, walls[i].p3);
+            quads.push_back(points);
+            fragments.push_back(Fragment{ points, (int)i });
+        }
+        for(auto& h : hints) {
+            fragments.push_back(Fragment{ quadPoints(h.p1, h.p2, h.p3), hintWall });
+        }
+
+        if(fragments.empty()) {
+            tree.leafBounds.push_back(AABB());
+        } else {
+            build(fragments);
+        }
+        computeVisibility();
+        return tree;
+    }
+
+private:
+    typedef std::vector<glm::vec3> Polygon;
+
+    struct Fragment {
+        Polygon points;
+        int wall;
+    };
+
+    // an opening out of a leaf, plane facing into the leaf it leads to
+    struct Portal {
+        Polygon polygon;
+        Plane plane;
+        int leaf;
+    };
+
+    // the part of a wall on a leaf's boundary
+    struct Face {
+        Polygon polygon;
+        int wall;
+    };
+
+    static const int hintWall = -1;
+
+    BSPTree tree;
+    std::vector<Polygon> quads;
+    AABB worldBounds;
+    std::vector<std::vector<Portal>> leafPortals;
+    std::vector<std::vector<Face>> leafFaces;
+
+    const float planeEpsilon = 1e-3f;
+
+    static Plane fragmentPlane(const Fragment& f) {
+        return Plane(f.points[0], f.points[1], f.points[2]);
+    }
+
+    // -1 back, 0 coplanar, 1 front, 2 spanning
+    int classify(const Polygon& points, const Plane& plane) const {
+        bool front = false, back = false;
+        for(auto& p : points) {
+            double d = plane.signedDistanceTo(p);
+            if(d >  planeEpsilon) front = true;
+            if(d < -planeEpsilon) back = true;
+        }
+        if(front && back) return 2;
+        if(front) return 1;
+        if(back) return -1;
+        return 0;
+    }
+
+    // pick the splitter that cuts the fewest fragments and keeps the halves even
+    size_t chooseSplitter(const std::vector<Fragment>& fragments) const {
+        size_t best = 0;
+        int bestScore = -1;
+        for(size_t i = 0; i < fragments.size(); i++) {
+            Plane plane = fragmentPlane(fragments[i]);
+            int front = 0, back = 0, splits = 0;
+            for(auto& f : fragments) {
+                int side = classify(f.points, plane);
+                if(side == 1) front++;
+                if(side == -1) back++;
+                if(side == 2) splits++;
+            }
+            int score = splits * 3 + glm::abs(front - back);
+            if(bestScore < 0 || score < bestScore) {
+                best = i;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    // returns the child index for this set of fragments
+    int build(const std::vector<Fragment>& fragments) {
+        if(fragments.empty()) {
+            tree.leafBounds.push_back(AABB());
+            return BSPTree::leafChild((int)tree.leafBounds.size() - 1);
+        }
+
+        Plane plane = fragmentPlane(fragments[chooseSplitter(fragments)]);
+        std::vector<Fragment> front, back;
+        std::vector<uint32_t> onPlane;
+
+        for(auto& f : fragments) {
+            switch(classify(f.points, plane)) {
+                case 0:
+                    if(f.wall == hintWall) break;
+                    if(std::find(onPlane.begin(), onPlane.end(), (uint32_t)f.wall) == onPlane.end())
+                        onPlane.push_back((uint32_t)f.wall);
+                    break;
+                case 1:
+                    front.push_back(f);
+                    break;
+                case -1:
+                    back.push_back(f);
+                    break;
+                default: {
+                    Plane flipped(plane.origin, -plane.normal);
+                    front.push_back(Fragment{ Frustum::clipPolygon(f.points, plane), f.wall });
+                    back.push_back(Fragment{ Frustum::clipPolygon(f.points, flipped), f.wall });
+                }
+            }
+        }
+
+        int index = (int)tree.nodes.size();
+        BSPNode node;
+        node.plane[0] = plane.normal.x;
+        node.plane[1] = plane.normal.y;
+        node.plane[2] = plane.normal.z;
+        node.plane[3] = plane.equation[3];
+        node.firstWall = (uint32_t)tree.nodeWalls.size();
+        node.wallCount = (uint32_t)onPlane.size();
+        tree.nodeWalls.insert(tree.nodeWalls.end(), onPlane.begin(), onPlane.end());
+        tree.nodes.push_back(node);
+
+        int frontChild = build(front);
+        int backChild = build(back);
+        tree.nodes[index].front = frontChild;
+        tree.nodes[index].back = backChild;
+        return index;
+    }
+
+    static Plane flip(const Plane& plane) {
+        return Plane(plane.origin, -plane.normal);
+    }
+
+    static Plane nodePlane(const BSPNode& node) {
+        glm::vec3 normal(node.plane[0], node.plane[1], node.plane[2]);
+        return Plane(-node.plane[3] * normal, normal);
+    }
+
+    // slivers left by clipping along an edge don't let anything through
+    bool usable(const Polygon& polygon) const {
+        if(polygon.size() < 3) return false;
+        glm::vec3 area(0.0f);
+        for(size_t i = 1; i + 1 < polygon.size(); i++) {
+            area += glm::cross(polygon[i] - polygon[0], polygon[i + 1] - polygon[0]);
+        }
+        return glm::length(area) * 0.5f > planeEpsilon * planeEpsilon;
+    }
+
+    // keeps what is in front of the plane, and anything within planeEpsilon of it
+    Polygon clipLoose(const Polygon& polygon, const Plane& plane) const {
+        return Frustum::clipPolygon(polygon, Plane(plane.origin - plane.normal * planeEpsilon, plane.normal));
+    }
+
+    // a quad on the plane big enough to cover the whole world box
+    Polygon planePolygon(const Plane& plane) const {
+        glm::vec3 axis = glm::abs(plane.normal.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+        float size = glm::length(worldBounds.max - worldBounds.min);
+        glm::vec3 u = glm::normalize(glm::cross(plane.normal, axis)) * size;
+        glm::vec3 v = glm::cross(plane.normal, u);
+        glm::vec3 c = worldBounds.center();
+        c -= plane.normal * (float)plane.signedDistanceTo(c);
+        return Polygon{ c - u - v, c + u - v, c + u + v, c - u + v };
+    }
+
+    // the face of the convex cell lying on cell[face]
+    Polygon cellFace(const std::vector<Plane>& cell, size_t face) const {
+        Polygon polygon = planePolygon(cell[face]);
+        for(size_t i = 0; i < cell.size() && polygon.size() >= 3; i++) {
+            if(i != face) polygon = Frustum::clipPolygon(polygon, cell[i]);
+        }
+        return polygon;
+    }
+
+    // cuts the polygon into the leaves below child
+    void splitDown(int child, const Polygon& polygon, std::vector<std::pair<int, Polygon>>& out) const {
+        if(!usable(polygon)) return;
+        if(BSPTree::isLeaf(child)) {
+            out.push_back({ ~child, polygon });
+            return;
+        }
+        const BSPNode& node = tree.nodes[child];
+        Plane plane = nodePlane(node);
+        switch(classify(polygon, plane)) {
+            case -1:
+                splitDown(node.back, polygon, out);
+                break;
+            case 2:
+                splitDown(node.front, Frustum::clipPolygon(polygon, plane), out);
+                splitDown(node.back, Frustum::clipPolygon(polygon, flip(plane)), out);
+                break;
+            default:
+                splitDown(node.front, polygon, out);
+        }
+    }
+
+    /*
+     * A piece of a node's plane between two leaves. Whatever the node's walls
+     * leave uncovered is open and becomes a portal both ways; the covered parts
+     * are faces of both leaves.
+     */
+    void addPortal(const BSPNode& node, const Plane& plane, int front, int back, const Polygon& piece) {
+        std::vector<Polygon> open = { piece };
+        for(uint32_t i = 0; i < node.wallCount; i++) {
+            int wall = (int)tree.nodeWalls[node.firstWall + i];
+            const auto& quad = quads[wall];
+            glm::vec3 center = (quad[0] + quad[2]) * 0.5f;
+
+            std::vector<Polygon> stillOpen;
+            for(auto& polygon : open) {
+                // peel off what lies outside each edge, the rest is under the wall
+                Polygon covered = polygon;
+                for(size_t e = 0; e < quad.size() && usable(covered); e++) {
+                    glm::vec3 normal = glm::normalize(glm::cross(quad[(e + 1) % quad.size()] - quad[e], plane.normal));
+                    if(glm::dot(normal, center - quad[e]) > 0) normal = -normal;
+                    Plane edge(quad[e], normal);
+                    Polygon outside = Frustum::clipPolygon(covered, edge);
+                    if(usable(outside)) stillOpen.push_back(outside);
+                    covered = Frustum::clipPolygon(covered, flip(edge));
+                }
+                if(usable(covered)) {
+                    leafFaces[front].push_back(Face{ covered, wall });
+                    leafFaces[back].push_back(Face{ covered, wall });
+                }
+            }
+            open = stillOpen;
+        }
+        for(auto& polygon : open) {
+            leafPortals[front].push_back(Portal{ polygon, flip(plane), back });
+            leafPortals[back].push_back(Portal{ polygon, plane, front });
+        }
+    }
+
+    // cell holds the planes bounding child's region, facing in
+    void buildPortals(int child, std::vector<Plane>& cell) {
+        if(BSPTree::isLeaf(child)) {
+            AABB bounds;
+            for(size_t i = 0; i < cell.size(); i++) {
+                for(auto& p : cellFace(cell, i)) bounds.expand(p);
+            }
+            tree.leafBounds[~child] = bounds;
+            return;
+        }
+
+        const BSPNode& node = tree.nodes[child];
+        Plane plane = nodePlane(node);
+        Polygon polygon = planePolygon(plane);
+        for(size_t i = 0; i < cell.size() && polygon.size() >= 3; i++) {
+            polygon = Frustum::clipPolygon(polygon, cell[i]);
+        }
+
+        std::vector<std::pair<int, Polygon>> fronts, backs;
+        splitDown(node.front, polygon, fronts);
+        for(auto& f : fronts) {
+            backs.clear();
+            splitDown(node.back, f.second, backs);
+            for(auto& b : backs) addPortal(node, plane, f.first, b.first, b.second);
+        }
+
+        cell.push_back(plane);
+        buildPortals(node.front, cell);
+        cell.back() = flip(plane);
+        buildPortals(node.back, cell);
+        cell.pop_back();
+    }
+
+    void setBit(std::vector<uint8_t>& rows, size_t rowBytes, size_t row, size_t bit) {
+        rows[row * rowBytes + (bit >> 3)] |= (uint8_t)(1 << (bit & 7));
+    }
+
+    bool isSet(const std::vector<uint8_t>& rows, size_t rowBytes, size_t row, size_t bit) const {
+        return rows[row * rowBytes + (bit >> 3)] & (1 << (bit & 7));
+    }
+
+    void computeVisibility() {
+        size_t leafCount = tree.leafCount();
+        tree.leafVisibility.assign(leafCount * tree.leafRowBytes(), 0);
+        tree.wallVisibility.assign(leafCount * tree.wallRowBytes(), 0);
+
+        worldBounds = AABB();
+        for(auto& q : quads) {
+            for(auto& p : q) worldBounds.expand(p);
+        }
+        if(worldBounds.isEmpty()) worldBounds = AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+        worldBounds.min -= glm::vec3(2.0f);
+        worldBounds.max += glm::vec3(2.0f, 5.0f, 2.0f);
+
+        leafPortals.assign(leafCount, std::vector<Portal>());
+        leafFaces.assign(leafCount, std::vector<Face>());
+        std::vector<Plane> cell = {
+            Plane(worldBounds.min, glm::vec3( 1, 0, 0)), Plane(worldBounds.max, glm::vec3(-1, 0, 0)),
+            Plane(worldBounds.min, glm::vec3( 0, 1, 0)), Plane(worldBounds.max, glm::vec3( 0,-1, 0)),
+            Plane(worldBounds.min, glm::vec3( 0, 0, 1)), Plane(worldBounds.max, glm::vec3( 0, 0,-1)),
+        };
+        buildPortals(tree.nodes.empty() ? BSPTree::leafChild(0) : 0, cell);
+
+        std::vector<bool> onPath(leafCount, false);
+        for(size_t a = 0; a < leafCount; a++) {
+            setBit(tree.leafVisibility, tree.leafRowBytes(), a, a);
+            for(auto& face : leafFaces[a]) setBit(tree.wallVisibility, tree.wallRowBytes(), a, face.wall);
+            onPath[a] = true;
+            for(auto& portal : leafPortals[a]) {
+                setBit(tree.leafVisibility, tree.leafRowBytes(), a, portal.leaf);
+                onPath[portal.leaf] = true;
+                flow(a, portal.plane, portal.polygon, nullptr, portal.leaf, onPath);
+                onPath[portal.leaf] = false;
+            }
+            onPath[a] = false;
+        }
+    }
+
+    /*
+     * Walks on from leaf, which sight from the source portal entered through
+     * pass. A line through source and pass stays on pass's side of every plane
+     * that has the two on opposite sides, so clipping the next portal to those
+     * planes keeps all of it that can be reached, and clipping the source the
+     * same way from the other end keeps all of it that can reach. The leaf's
+     * wall faces are clipped the same way, so a wall is only marked when some
+     * line of sight can actually land on it.
+     */
+    void flow(size_t from, const Plane& sourcePlane, const Polygon& source, const Polygon* pass,
+              int leaf, std::vector<bool>& onPath) {
+        for(auto& face : leafFaces[leaf]) {
+            if(isSet(tree.wallVisibility, tree.wallRowBytes(), from, face.wall)) continue;
+            if(!ahead(face.polygon, sourcePlane)) continue;
+            Polygon target = clipLoose(face.polygon, sourcePlane);
+            if(pass) target = clipToSeparators(source, *pass, target);
+            if(usable(target)) setBit(tree.wallVisibility, tree.wallRowBytes(), from, face.wall);
+        }
+
+        for(auto& portal : leafPortals[leaf]) {
+            if(onPath[portal.leaf]) continue;
+            if(!ahead(portal.polygon, sourcePlane)) continue;
+            Polygon target = clipLoose(portal.polygon, sourcePlane);
+
+            Polygon narrowed = source;
+            if(pass) {
+                narrowed = clipLoose(source, flip(portal.plane));
+                if(!usable(narrowed)) continue;
+                target = clipToSeparators(narrowed, *pass, target);
+                if(!usable(target)) continue;
+                narrowed = clipToSeparators(target, *pass, narrowed);
+                if(!usable(narrowed)) continue;
+            } else if(!usable(target)) {
+                continue;
+            }
+
+            setBit(tree.leafVisibility, tree.leafRowBytes(), from, portal.leaf);
+            onPath[portal.leaf] = true;
+            flow(from, sourcePlane, narrowed, &target, portal.leaf, onPath);
+            onPath[portal.leaf] = false;
+        }
+    }
+
+    // sight left the source going forward, so only what is ahead of it can be reached
+    bool ahead(const Polygon& polygon, const Plane& sourcePlane) const {
+        for(auto& p : polygon) {
+            if(sourcePlane.signedDistanceTo(p) > planeEpsilon) return true;
+        }
+        return false;
+    }
+
+    // clips target to the planes through an edge of one of source and pass and a corner of the other that separate them
+    Polygon clipToSeparators(const Polygon& source, const Polygon& pass, Polygon target) const {
+        for(int side = 0; side < 2; side++) {
+            const Polygon& edges = side ? source : pass;
+            const Polygon& corners = side ? pass : source;
+            for(size_t i = 0; i < edges.size(); i++) {
+                glm::vec3 a = edges[i];
+                glm::vec3 b = edges[(i + 1) % edges.size()];
+                for(auto& c : corners) {
+                    glm::vec3 normal = glm::cross(b - a, c - a);
+                    float length = glm::length(normal);
+                    if(length < planeEpsilon) continue;
+                    Plane plane(a, normal / length);
+
+                    int separation = separates(plane, source, pass);
+                    if(separation == 0) continue;
+                    target = clipLoose(target, separation > 0 ? plane : flip(plane));
+                    if(target.size() < 3) return target;
+                }
+            }
+        }
+        return target;
+    }
+
+    // 1 when source is behind the plane and pass in front of it, -1 the other way round, 0 neither
+    int separates(const Plane& plane, const Polygon& source, const Polygon& pass) const {
+        bool sourceFront = false, sourceBack = false, passFront = false, passBack = false;
+        for(auto& p : source) {
+            double d = plane.signedDistanceTo(p);
+            if(d >  planeEpsilon) sourceFront = true;
+            if(d < -planeEpsilon) sourceBack = true;
+        }
+        for(auto& p : pass) {
+            double d = plane.signedDistanceTo(p);
+            if(d >  planeEpsilon) passFront = true;
+            if(d < -planeEpsilon) passBack = true;
+        }
+        if(!sourceFront && !passBack) return 1;
+        if(!sourceBack && !passFront) return -1;
+        return 0;
+    }
+};
+#endif
@@ -0,0 +1,225 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "TextureImage.h"
+
+/*
+ * BC1 and BC3 (S3TC/DXT1 and DXT5) block encoders for the offline cooker and
+ * decoders for GPUs without S3TC and for checking cooked output. Blocks are
+ * passed as 16 RGBA texels, row by row.
+ *
+ * The color encoder fits a line through the block along its principal axis
+ * and picks the texels at either end as endpoints, which is fast and close to
+ * what heavier encoders reach on photographic textures. Alpha uses the block's
+ * min and max.
+ */
+
+inline uint16_t packRGB565(const uint8_t* rgb) {
+    return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+inline void unpackRGB565(uint16_t color, uint8_t* rgb) {
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (uint8_t)((r << 3) | (r >> 2));
+    rgb[1] = (uint8_t)((g << 2) | (g >> 4));
+    rgb[2] = (uint8_t)((b << 3) | (b >> 2));
+}
+
+// fourColor: BC3 color blocks never use the 3 color + transparent mode
+inline void decodeColorBlock(const uint8_t* block, uint8_t* rgba, bool fourColor) {
+    uint16_t c0 = (uint16_t)(block[0] | block[1] << 8);
+    uint16_t c1 = (uint16_t)(block[2] | block[3] << 8);
+    uint8_t palette[4][4];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+    for(int c = 0; c < 3; c++) {
+        if(fourColor || c0 > c1) {
+            palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c]) / 3);
+        } else {
+            palette[2][c] = (uint8_t)((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    if(!fourColor && c0 <= c1) palette[3][3] = 0;
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+    for(int i = 0; i < 16; i++) {
+        memcpy(rgba + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+inline void encodeColorBlock(const uint8_t* rgba, uint8_t* block) {
+    float mean[3] = { 0, 0, 0 };
+    for(int i = 0; i < 16; i++) {
+        for(int c = 0; c < 3; c++) mean[c] += rgba[i * 4 + c] / 16.0f;
+    }
+    float covariance[6] = { 0, 0, 0, 0, 0, 0 };
+    for(int i = 0; i < 16; i++) {
+        float r = rgba[i * 4] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+    // a few power iterations are plenty for a 3x3 matrix
+    float axis[3] = { 1, 1, 1 };
+    for(int iteration = 0; iteration < 4; iteration++) {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if(length < 1e-6f) break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    int minIndex = 0, maxIndex = 0;
+    float minDot = 1e30f, maxDot = -1e30f;
+    for(int i = 0; i < 16; i++) {
+        float dot = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+        if(dot < minDot) { minDot = dot; minIndex = i; }
+        if(dot > maxDot) { maxDot = dot; maxIndex = i; }
+    }
+
+    uint16_t c0 = packRGB565(rgba + maxIndex * 4);
+    uint16_t c1 = packRGB565(rgba + minIndex * 4);
+    if(c0 < c1) std::swap(c0, c1);
+    uint32_t indices = 0;
+    // a single quantized color, every index 0 picks it
+    if(c0 != c1) {
+        uint8_t palette[4][3];
+        unpackRGB565(c0, palette[0]);
+        unpackRGB565(c1, palette[1]);
+        for(int c = 0; c < 3; c++) {
+            palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        for(int i = 0; i < 16; i++) {
+            int best = 0, bestError = 1 << 30;
+            for(int p = 0; p < 4; p++) {
+                int dr = rgba[i * 4] - palette[p][0], dg = rgba[i * 4 + 1] - palette[p][1], db = rgba[i * 4 + 2] - palette[p][2];
+                int error = dr * dr + dg * dg + db * db;
+                if(error < bestError) { bestError = error; best = p; }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    block[0] = (uint8_t)c0; block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)c1; block[3] = (uint8_t)(c1 >> 8);
+    for(int i = 0; i < 4; i++) block[4 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+inline void decodeAlphaBlock(const uint8_t* block, uint8_t* rgba) {
+    uint8_t palette[8] = { block[0], block[1] };
+    if(block[0] > block[1]) {
+        for(int i = 1; i < 7; i++) palette[i + 1] = (uint8_t)(((7 - i) * block[0] + i * block[1]) / 7);
+    } else {
+        for(int i = 1; i < 5; i++) palette[i + 1] = (uint8_t)(((5 - i) * block[0] + i * block[1]) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t indices = 0;
+    for(int i = 0; i < 6; i++) indices |= (uint64_t)block[2 + i] << (8 * i);
+    for(int i = 0; i < 16; i++) rgba[i * 4 + 3] = palette[(indices >> (3 * i)) & 7];
+}
+
+inline void encodeAlphaBlock(const uint8_t* rgba, uint8_t* block) {
+    uint8_t a0 = 0, a1 = 255;
+    for(int i = 0; i < 16; i++) {
+        a0 = std::max(a0, rgba[i * 4 + 3]);
+        a1 = std::min(a1, rgba[i * 4 + 3]);
+    }
+    uint64_t indices = 0;
+    if(a0 != a1) {
+        uint8_t palette[8] = { a0, a1 };
+        for(int i = 1; i < 7; i++) palette[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+        for(int i = 0; i < 16; i++) {
+            int best = 0, bestError = 256;
+            for(int p = 0; p < 8; p++) {
+                int error = std::abs(rgba[i * 4 + 3] - palette[p]);
+                if(error < bestError) { bestError = error; best = p; }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    block[0] = a0;
+    block[1] = a1;
+    for(int i = 0; i < 6; i++) block[2 + i] = (uint8_t)(indices >> (8 * i));
+}
+
+// BC1 or BC3 chain from an RGB8 or RGBA8 one, edge blocks repeat the last texels
+inline std::unique_ptr<TextureImage> compressImage(const TextureImage& source, TextureFormat format) {
+    int channels = TextureImage::channels(source.format);
+    int blockBytes = TextureImage::blockBytes(format);
+    std::vector<unsigned char> bytes(TextureImage::chainSize(format, source.width, source.height));
+    unsigned char* out = bytes.data();
+
+    for(int level = 0; level < source.levels; level++) {
+        int width = source.levelWidth(level), height = source.levelHeight(level);
+        const unsigned char* pixels = source.level(level);
+        for(int by = 0; by < height; by += 4) {
+            for(int bx = 0; bx < width; bx += 4) {
+                uint8_t rgba[64];
+                for(int i = 0; i < 16; i++) {
+                    int x = std::min(bx + i % 4, width - 1), y = std::min(by + i / 4, height - 1);
+                    const unsigned char* texel = pixels + ((size_t)y * width + x) * channels;
+                    rgba[i * 4] = texel[0];
+                    rgba[i * 4 + 1] = texel[1];
+                    rgba[i * 4 + 2] = texel[2];
+                    rgba[i * 4 + 3] = channels == 4 ? texel[3] : 255;
+                }
+                if(format == FORMAT_BC3) {
+                    encodeAlphaBlock(rgba, out);
+                    encodeColorBlock(rgba, out + 8);
+                } else {
+                    encodeColorBlock(rgba, out);
+                }
+                out += blockBytes;
+            }
+        }
+    }
+    return TextureImage::fromBytes(std::move(bytes), format, source.width, source.height, source.levels);
+}
+
+// RGB8 or RGBA8 chain with the same levels; BC1 alpha is opaque
+inline std::unique_ptr<TextureImage> decompressImage(const TextureImage& source, TextureFormat format) {
+    int channels = TextureImage::channels(format);
+    int blockBytes = TextureImage::blockBytes(source.format);
+    std::vector<unsigned char> bytes(TextureImage::chainSize(format, source.width, source.height));
+    unsigned char* out = bytes.data();
+
+    for(int level = 0; level < source.levels; level++) {
+        int width = source.levelWidth(level), height = source.levelHeight(level);
+        const unsigned char* block = source.level(level);
+        for(int by = 0; by < height; by += 4) {
+            for(int bx = 0; bx < width; bx += 4) {
+                uint8_t rgba[64];
+                if(source.format == FORMAT_BC3) {
+                    decodeColorBlock(block + 8, rgba, true);
+                    decodeAlphaBlock(block, rgba);
+                } else {
+                    decodeColorBlock(block, rgba, false);
+                }
+                block += blockBytes;
+                for(int i = 0; i < 16; i++) {
+                    int x = bx + i % 4, y = by + i / 4;
+                    if(x >= width || y >= height) continue;
+                    memcpy(out + ((size_t)y * width + x) * channels, rgba + i * 4, channels);
+                }
+            }
+        }
+        out += (size_t)width * height * channels;
+    }
+    return TextureImage::fromBytes(std::move(bytes), format, source.width, source.height, source.levels);
+}
+
+// RGB8 (BC1) or RGBA8 (BC3)
+inline std::unique_ptr<TextureImage> decompressImage(const TextureImage& source) {
+    return decompressImage(source, source.format == FORMAT_BC1 ? FORMAT_RGB8 : FORMAT_RGBA8);
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef FRAGMENT_COUNTER_H
+#define FRAGMENT_COUNTER_H
+
+#include <glad/glad.h>
+#include "GLExtensions.h"
+
+/*
+ * Counts fragments shaded between begin() and end(), for comparing the
+ * lighting pass with and without the depth pre-pass. Uses fragment shader
+ * invocations from ARB_pipeline_statistics_query when available, otherwise
+ * GL_SAMPLES_PASSED, which only counts fragments that passed the depth test
+ * (close to the shaded count with early depth testing) and can't overlap
+ * the ANY_SAMPLES_PASSED queries of OcclusionQueries.
+ *
+ * A few queries are rotated and only read once available, so the count lags
+ * by a frame or two and never stalls.
+ */
+class FragmentCounter {
+public:
+    // count of the last finished frame, -1 until there is one
+    long long lastCount = -1;
+
+    void init() {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    GLenum target() const {
+        return glExtensions().pipelineStatistics ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED;
+    }
+
+    bool isPipelineStatistics() const {
+        return glExtensions().pipelineStatistics;
+    }
+
+    // returns false when counting can't run this frame
+    bool begin(bool occlusionQueriesActive) {
+        collect();
+        active = !(occlusionQueriesActive && !isPipelineStatistics()) && !pending[next];
+        if(active) glBeginQuery(target(), queries[next]);
+        return active;
+    }
+
+    void end() {
+        if(!active) return;
+        glEndQuery(target());
+        pending[next] = true;
+        next = (next + 1) % QUERY_COUNT;
+        active = false;
+    }
+
+private:
+    static const int QUERY_COUNT = 3;
+    GLuint queries[QUERY_COUNT];
+    bool pending[QUERY_COUNT] = {};
+    int next = 0;
+    bool active = false;
+
+    void collect() {
+        // oldest first, so lastCount ends up the newest result
+        for(int k = 0; k < QUERY_COUNT; k++) {
+            int i = (next + k) % QUERY_COUNT;
+            if(!pending[i]) continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available) continue;
+            GLuint64 count = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &count);
+            lastCount = (long long)count;
+            pending[i] = false;
+        }
+    }
+};
+#endif
@@ -0,0 +1,110 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "Plane.h"
+
+// A convex volume bounded by planes, inside is the positive side of every plane.
+class Frustum {
+public:
+    std::vector<Plane> planes;
+
+    Frustum() {}
+
+    /* Gribb & Hartmann plane extraction, glm matrices are column major */
+    explicit Frustum(const glm::mat4& viewProjection) {
+        glm::vec4 rows[4];
+        for(int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+        addPlane(rows[3] + rows[0]); // left
+        addPlane(rows[3] - rows[0]); // right
+        addPlane(rows[3] + rows[1]); // bottom
+        addPlane(rows[3] - rows[1]); // top
+        addPlane(rows[3] + rows[2]); // near
+        addPlane(rows[3] - rows[2]); // far
+    }
+
+    // narrowed frustum looking from the eye through a convex polygon,
+    // capped by the polygon itself so nothing in front of it passes
+    static Frustum throughPolygon(const glm::vec3& eye, const std::vector<glm::vec3>& polygon) {
+        Frustum frustum;
+        if(polygon.size() < 3) return frustum;
+
+        glm::vec3 centroid(0.0f);
+        for(auto& p : polygon) centroid += p;
+        centroid /= (float)polygon.size();
+
+        for(size_t i = 0; i < polygon.size(); i++) {
+            const glm::vec3& a = polygon[i];
+            const glm::vec3& b = polygon[(i + 1) % polygon.size()];
+            glm::vec3 normal = glm::cross(a - eye, b - eye);
+            if(glm::length(normal) < 1e-6f) continue;
+            normal = glm::normalize(normal);
+            if(glm::dot(normal, centroid - eye) < 0) normal = -normal;
+            frustum.planes.push_back(Plane(eye, normal));
+        }
+
+        Plane cap(polygon[0], polygon[1], polygon[2]);
+        glm::vec3 capNormal = cap.normal;
+        if(glm::dot(capNormal, eye - polygon[0]) > 0) capNormal = -capNormal;
+        frustum.planes.push_back(Plane(polygon[0], capNormal));
+        return frustum;
+    }
+
+    bool intersects(const AABB& box) const {
+        for(const Plane& plane : planes) {
+            // corner furthest along the plane normal
+            glm::vec3 positive(
+                plane.normal.x >= 0 ? box.max.x : box.min.x,
+                plane.normal.y >= 0 ? box.max.y : box.min.y,
+                plane.normal.z >= 0 ? box.max.z : box.min.z
+            );
+            if(plane.signedDistanceTo(positive) < 0) return false;
+        }
+        return true;
+    }
+
+    bool intersects(const std::vector<glm::vec3>& polygon) const {
+        return !clip(polygon).empty();
+    }
+
+    /* Sutherland-Hodgman against every plane, returns an empty polygon when fully outside */
+    std::vector<glm::vec3> clip(const std::vector<glm::vec3>& polygon) const {
+        std::vector<glm::vec3> result = polygon;
+        for(const Plane& plane : planes) {
+            result = clipPolygon(result, plane);
+            if(result.size() < 3) return std::vector<glm::vec3>();
+        }
+        return result;
+    }
+
+    static std::vector<glm::vec3> clipPolygon(const std::vector<glm::vec3>& polygon, const Plane& plane) {
+        std::vector<glm::vec3> out;
+        for(size_t i = 0; i < polygon.size(); i++) {
+            const glm::vec3& a = polygon[i];
+            const glm::vec3& b = polygon[(i + 1) % polygon.size()];
+            double da = plane.signedDistanceTo(a);
+            double db = plane.signedDistanceTo(b);
+
+            if(da >= 0) out.push_back(a);
+            if((da >= 0) != (db >= 0)) {
+                float t = (float)(da / (da - db));
+                out.push_back(a + (b - a) * t);
+            }
+        }
+        return out;
+    }
+
+private:
+    void addPlane(const glm::vec4& equation) {
+        glm::vec3 normal(equation);
+        float length = glm::length(normal);
+        normal /= length;
+        float d = equation.w / length;
+        planes.push_back(Plane(-d * normal, normal));
+    }
+};
+#endif
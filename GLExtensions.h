@@ -0,0 +1,182 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+#include <cstring>
+
+/*
+ * The bundled glad loader only covers core 3.3. Entry points from newer
+ * versions and extensions are loaded here at runtime, and each feature flag
+ * is only set when the context version or extension string provides it.
+ */
+
+// GL 4.3 compute and storage buffers
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// ARB_indirect_parameters / GL 4.6
+#ifndef GL_PARAMETER_BUFFER_ARB
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#endif
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// ARB_pipeline_statistics_query / GL 4.6
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// EXT_texture_sRGB / EXT_texture_compression_s3tc_srgb
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+typedef void (APIENTRYP PFNGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFNGLTEXSTORAGE3DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth);
+typedef void (APIENTRYP PFNGLCOPYIMAGESUBDATAPROC)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+
+class GLExtensions {
+public:
+    int major = 0;
+    int minor = 0;
+
+    // compute shaders, storage buffers and glMultiDrawElementsIndirect
+    bool gpuDriven = false;
+    // draw count read from a GPU buffer
+    bool indirectCount = false;
+    // linked programs can be saved and reloaded, with at least one binary format
+    bool programBinary = false;
+    // compile and link status can be polled without waiting for the driver
+    bool parallelCompile = false;
+    // fragment shader invocation counts through queries
+    bool pipelineStatistics = false;
+    // BC1/BC3 textures upload as they are
+    bool textureCompressionS3TC = false;
+    // and their sRGB variants
+    bool textureCompressionS3TCSRGB = false;
+    // immutable texture storage, every level allocated at once
+    bool textureStorage = false;
+    // texel copies between textures on the GPU, compressed blocks included
+    bool copyImage = false;
+
+    PFNGLDISPATCHCOMPUTEPROC dispatchCompute = nullptr;
+    PFNGLMEMORYBARRIERPROC memoryBarrier = nullptr;
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect = nullptr;
+    PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC multiDrawElementsIndirectCount = nullptr;
+    PFNGLGETPROGRAMBINARYPROC getProgramBinary = nullptr;
+    PFNGLPROGRAMBINARYPROC programBinaryLoad = nullptr;
+    PFNGLPROGRAMPARAMETERIPROC programParameteri = nullptr;
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = nullptr;
+    PFNGLTEXSTORAGE2DPROC texStorage2D = nullptr;
+    PFNGLTEXSTORAGE3DPROC texStorage3D = nullptr;
+    PFNGLCOPYIMAGESUBDATAPROC copyImageSubData = nullptr;
+
+    // call once after gladLoadGLLoader with the same loader
+    void load(GLADloadproc loader) {
+        major = GLVersion.major;
+        minor = GLVersion.minor;
+
+        if(atLeast(4, 3)) {
+            dispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)loader("glDispatchCompute");
+            memoryBarrier = (PFNGLMEMORYBARRIERPROC)loader("glMemoryBarrier");
+            multiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)loader("glMultiDrawElementsIndirect");
+            gpuDriven = dispatchCompute && memoryBarrier && multiDrawElementsIndirect;
+        }
+
+        if(atLeast(4, 6)) {
+            multiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC)loader("glMultiDrawElementsIndirectCount");
+        } else if(has("GL_ARB_indirect_parameters")) {
+            multiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC)loader("glMultiDrawElementsIndirectCountARB");
+        }
+        indirectCount = gpuDriven && multiDrawElementsIndirectCount;
+
+        if(atLeast(4, 1) || has("GL_ARB_get_program_binary")) {
+            getProgramBinary = (PFNGLGETPROGRAMBINARYPROC)loader("glGetProgramBinary");
+            programBinaryLoad = (PFNGLPROGRAMBINARYPROC)loader("glProgramBinary");
+            programParameteri = (PFNGLPROGRAMPARAMETERIPROC)loader("glProgramParameteri");
+            // some drivers expose the entry points but no formats
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            programBinary = getProgramBinary && programBinaryLoad && programParameteri && formats > 0;
+        }
+
+        pipelineStatistics = atLeast(4, 6) || has("GL_ARB_pipeline_statistics_query");
+        textureCompressionS3TC = has("GL_EXT_texture_compression_s3tc");
+        textureCompressionS3TCSRGB = textureCompressionS3TC
+            && (has("GL_EXT_texture_sRGB") || has("GL_EXT_texture_compression_s3tc_srgb"));
+
+        // ARB_texture_storage entry points have no suffix
+        if(atLeast(4, 2) || has("GL_ARB_texture_storage")) {
+            texStorage2D = (PFNGLTEXSTORAGE2DPROC)loader("glTexStorage2D");
+            texStorage3D = (PFNGLTEXSTORAGE3DPROC)loader("glTexStorage3D");
+            textureStorage = texStorage2D && texStorage3D;
+        }
+
+        // ARB_copy_image has no suffix either
+        if(atLeast(4, 3) || has("GL_ARB_copy_image")) {
+            copyImageSubData = (PFNGLCOPYIMAGESUBDATAPROC)loader("glCopyImageSubData");
+            copyImage = copyImageSubData != nullptr;
+        }
+
+        if(has("GL_KHR_parallel_shader_compile")) {
+            maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsKHR");
+            parallelCompile = true;
+            // let the driver pick the thread count
+            if(maxShaderCompilerThreads) maxShaderCompilerThreads(0xFFFFFFFF);
+        } else if(has("GL_ARB_parallel_shader_compile")) {
+            maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsARB");
+            parallelCompile = true;
+            if(maxShaderCompilerThreads) maxShaderCompilerThreads(0xFFFFFFFF);
+        }
+    }
+
+    bool atLeast(int wantMajor, int wantMinor) const {
+        return major > wantMajor || (major == wantMajor && minor >= wantMinor);
+    }
+
+    bool has(const char* extension) const {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for(GLint i = 0; i < count; i++) {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if(name && strcmp(name, extension) == 0) return true;
+        }
+        return false;
+    }
+};
+
+inline GLExtensions& glExtensions() {
+    static GLExtensions extensions;
+    return extensions;
+}
+#endif
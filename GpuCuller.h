@@ -0,0 +1,156 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GLExtensions.h"
+#include "Frustum.h"
+#include "Mesh.h"
+#include "Wall.h"
+#include "shader.h"
+
+/*
+ * GPU-driven path for GL 4.3+. All walls live in one vertex/index buffer,
+ * their bounds and draw commands in storage buffers. A compute shader
+ * frustum-culls every object and writes the survivors' commands into the
+ * indirect buffer, then one multi-draw submits them. With indirect draw
+ * counts the list is compacted and the GPU-side count is used; otherwise every
+ * slot stays in place with instanceCount zeroed for culled objects.
+ */
+class GpuCuller {
+public:
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    static bool isSupported() {
+        return glExtensions().gpuDriven;
+    }
+
+    // walls must already have their final vertices (materials set)
+    void init(std::vector<Wall>& walls) {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<glm::vec4> bounds;
+        std::vector<DrawCommand> commands;
+
+        for(Wall& w : walls) {
+            Mesh& mesh = w.getMesh();
+            // virtual-textured walls need another program, they keep their slot but draw nothing here
+            GLuint count = w.isVirtualTextured() ? 0 : (GLuint)mesh.indices.size();
+            commands.push_back(DrawCommand{ count, 1, (GLuint)indices.size(), (GLint)vertices.size(), 0 });
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+            AABB box = w.getBounds();
+            bounds.push_back(glm::vec4(box.center(), 0.0f));
+            bounds.push_back(glm::vec4(box.extents(), 0.0f));
+        }
+        objectCount = (GLsizei)commands.size();
+        compact = glExtensions().indirectCount;
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Layer));
+        glEnableVertexAttribArray(3);
+        glBindVertexArray(0);
+
+        boundsBuffer = storageBuffer(bounds.data(), sizeof(glm::vec4) * bounds.size(), GL_STATIC_DRAW);
+        commandBuffer = storageBuffer(commands.data(), sizeof(DrawCommand) * commands.size(), GL_STATIC_DRAW);
+        visibleBuffer = storageBuffer(commands.data(), sizeof(DrawCommand) * commands.size(), GL_DYNAMIC_COPY);
+        GLuint zero = 0;
+        countBuffer = storageBuffer(&zero, sizeof(GLuint), GL_DYNAMIC_COPY);
+        maskWords.assign((commands.size() + 31) / 32, 0u);
+        maskBuffer = storageBuffer(maskWords.data(), sizeof(GLuint) * maskWords.size(), GL_DYNAMIC_DRAW);
+
+        cullShader.reset(new Shader("./shaders/cull_compute.glsl"));
+    }
+
+    // one bit per wall, in wall order; nullptr turns the mask off
+    void setVisibilityMask(const uint8_t* bits) {
+        useMask = bits != nullptr;
+        if(!useMask) return;
+        std::fill(maskWords.begin(), maskWords.end(), 0u);
+        memcpy(maskWords.data(), bits, (objectCount + 7) / 8);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, maskBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * maskWords.size(), maskWords.data());
+    }
+
+    void cull(const glm::mat4& viewProjection) {
+        Frustum frustum(viewProjection);
+        glm::vec4 planes[6];
+        for(int i = 0; i < 6; i++) {
+            planes[i] = glm::vec4(frustum.planes[i].normal, frustum.planes[i].equation[3]);
+        }
+
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+
+        cullShader->use();
+        cullShader->set(uniforms::frustumPlanes, planes);
+        cullShader->set(uniforms::objectCount, (unsigned int)objectCount);
+        cullShader->set(uniforms::useMask, useMask);
+        cullShader->set(uniforms::compact, compact);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, boundsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, maskBuffer);
+
+        glExtensions().dispatchCompute((objectCount + 63) / 64, 1, 1);
+        glExtensions().memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // draws with whatever program is bound, one call for every wall not virtual-textured
+    void draw() {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, visibleBuffer);
+        if(compact) {
+            glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+            glExtensions().multiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, objectCount, 0);
+        } else {
+            glExtensions().multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, objectCount, 0);
+        }
+    }
+
+private:
+    std::unique_ptr<Shader> cullShader;
+
+    unsigned int VAO, VBO, EBO;
+    GLuint boundsBuffer, commandBuffer, visibleBuffer, countBuffer, maskBuffer;
+    std::vector<GLuint> maskWords;
+
+    GLsizei objectCount = 0;
+    bool compact = false;
+    bool useMask = false;
+
+    static GLuint storageBuffer(const void* data, size_t size, GLenum usage) {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage);
+        return buffer;
+    }
+};
+#endif
@@ -0,0 +1,220 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "stb_image.h"
+
+#if defined(HAVE_LIBJPEG)
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+#if defined(HAVE_LIBPNG)
+#include <png.h>
+#endif
+
+// 8 bit pixels, rows tightly packed
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+};
+
+/*
+ * Turns an encoded image file into RGB8 or RGBA8 pixels. Backends are tried
+ * in imageDecoders() order and the first one that accepts the file and
+ * decodes it wins, so a file a fast path can't handle (CMYK JPEGs, say)
+ * still loads through stb_image. Decoders are stateless and safe to call from
+ * worker threads.
+ *
+ * The fast paths are built when the Makefile finds their libraries:
+ * libjpeg-turbo, whose Huffman decoding, IDCT, upsampling and color
+ * conversion are SIMD, and libpng. stb_image always comes last; it uses SSE2
+ * for the JPEG IDCT and color conversion, and NEON when STBI_NEON is defined
+ * where the implementation is compiled.
+ */
+class ImageDecoder {
+public:
+    virtual ~ImageDecoder() {}
+
+    virtual const char* name() const = 0;
+
+    // a quick look at the signature, not a guarantee decode() succeeds
+    virtual bool accepts(const unsigned char* data, size_t size) const = 0;
+
+    // channels is 3 or 4; false with a reason when the file can't be decoded
+    virtual bool decode(const unsigned char* data, size_t size, int channels,
+                        DecodedImage& image, std::string& error) const = 0;
+};
+
+class StbImageDecoder : public ImageDecoder {
+public:
+    const char* name() const override { return "stb_image"; }
+
+    bool accepts(const unsigned char*, size_t) const override { return true; }
+
+    bool decode(const unsigned char* data, size_t size, int channels,
+                DecodedImage& image, std::string& error) const override {
+        int width, height, fileChannels;
+        unsigned char* pixels = stbi_load_from_memory(data, (int)size, &width, &height, &fileChannels, channels);
+        if(!pixels) {
+            error = stbi_failure_reason();
+            return false;
+        }
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.pixels.assign(pixels, pixels + (size_t)width * height * channels);
+        stbi_image_free(pixels);
+        return true;
+    }
+};
+
+#if defined(HAVE_LIBJPEG)
+class JpegDecoder : public ImageDecoder {
+public:
+    const char* name() const override { return "libjpeg-turbo"; }
+
+    bool accepts(const unsigned char* data, size_t size) const override {
+        return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+    }
+
+    bool decode(const unsigned char* data, size_t size, int channels,
+                DecodedImage& image, std::string& error) const override {
+#if !defined(JCS_EXTENSIONS)
+        // plain libjpeg can't add an alpha channel
+        if(channels == 4) {
+            error = "libjpeg without JCS_EXTENSIONS only decodes to RGB";
+            return false;
+        }
+#endif
+        jpeg_decompress_struct info;
+        ErrorManager errors;
+        info.err = jpeg_std_error(&errors.base);
+        errors.base.error_exit = [](j_common_ptr common) {
+            ErrorManager* manager = (ErrorManager*)common->err;
+            (*common->err->format_message)(common, manager->message);
+            longjmp(manager->jump, 1);
+        };
+        errors.base.output_message = [](j_common_ptr) {};
+        // nothing with a destructor is created between here and the longjmp
+        if(setjmp(errors.jump)) {
+            error = errors.message;
+            jpeg_destroy_decompress(&info);
+            return false;
+        }
+
+        jpeg_create_decompress(&info);
+        jpeg_mem_src(&info, data, (unsigned long)size);
+        jpeg_read_header(&info, TRUE);
+#if defined(JCS_EXTENSIONS)
+        info.out_color_space = channels == 4 ? JCS_EXT_RGBA : JCS_RGB;
+#else
+        info.out_color_space = JCS_RGB;
+#endif
+        jpeg_start_decompress(&info);
+
+        image.width = (int)info.output_width;
+        image.height = (int)info.output_height;
+        image.channels = channels;
+        image.pixels.resize((size_t)image.width * image.height * channels);
+        size_t pitch = (size_t)image.width * channels;
+        while(info.output_scanline < info.output_height) {
+            // as many rows as the decoder hands out at once
+            JSAMPROW rows[4];
+            int count = 0;
+            for(; count < 4 && info.output_scanline + count < info.output_height; count++) {
+                rows[count] = image.pixels.data() + (info.output_scanline + count) * pitch;
+            }
+            jpeg_read_scanlines(&info, rows, count);
+        }
+        jpeg_finish_decompress(&info);
+        jpeg_destroy_decompress(&info);
+        return true;
+    }
+
+private:
+    struct ErrorManager {
+        jpeg_error_mgr base;
+        jmp_buf jump;
+        char message[JMSG_LENGTH_MAX];
+    };
+};
+#endif
+
+#if defined(HAVE_LIBPNG)
+class PngDecoder : public ImageDecoder {
+public:
+    const char* name() const override { return "libpng"; }
+
+    bool accepts(const unsigned char* data, size_t size) const override {
+        static const unsigned char SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        return size >= 8 && memcmp(data, SIGNATURE, 8) == 0;
+    }
+
+    bool decode(const unsigned char* data, size_t size, int channels,
+                DecodedImage& image, std::string& error) const override {
+        png_image png;
+        memset(&png, 0, sizeof(png));
+        png.version = PNG_IMAGE_VERSION;
+        if(!png_image_begin_read_from_memory(&png, data, size)) {
+            error = png.message;
+            return false;
+        }
+        // alpha is dropped rather than composited, like stb_image does
+        bool dropAlpha = channels == 3 && (png.format & PNG_FORMAT_FLAG_ALPHA);
+        png.format = channels == 4 || dropAlpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+        image.width = (int)png.width;
+        image.height = (int)png.height;
+        image.channels = channels;
+        image.pixels.resize(PNG_IMAGE_SIZE(png));
+        if(!png_image_finish_read(&png, nullptr, image.pixels.data(), 0, nullptr)) {
+            error = png.message;
+            png_image_free(&png);
+            return false;
+        }
+        if(dropAlpha) {
+            size_t count = (size_t)image.width * image.height;
+            for(size_t i = 0; i < count; i++) memmove(&image.pixels[i * 3], &image.pixels[i * 4], 3);
+            image.pixels.resize(count * 3);
+        }
+        return true;
+    }
+};
+#endif
+
+// fastest first, stb_image last since it takes anything
+inline const std::vector<const ImageDecoder*>& imageDecoders() {
+#if defined(HAVE_LIBJPEG)
+    static const JpegDecoder jpeg;
+#endif
+#if defined(HAVE_LIBPNG)
+    static const PngDecoder png;
+#endif
+    static const StbImageDecoder stb;
+    static const std::vector<const ImageDecoder*> decoders = {
+#if defined(HAVE_LIBJPEG)
+        &jpeg,
+#endif
+#if defined(HAVE_LIBPNG)
+        &png,
+#endif
+        &stb,
+    };
+    return decoders;
+}
+
+// the first decoder that accepts the file and succeeds; the last failure's reason otherwise
+inline bool decodeImage(const void* data, size_t size, int channels, DecodedImage& image, std::string& error) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(const ImageDecoder* decoder : imageDecoders()) {
+        if(decoder->accepts(bytes, size) && decoder->decode(bytes, size, channels, image, error)) return true;
+    }
+    return false;
+}
+#endif
@@ -0,0 +1,150 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TextureImage.h"
+
+/*
+ * Just enough of KTX 2.0 for the cooked textures: one 2D face, no array
+ * layers, no supercompression, BC1 or BC3 with a full mip chain. The writer
+ * emits the basic data format descriptor so other KTX2 tools accept the
+ * files; the reader only checks the header and the level index.
+ *
+ * As the format requires, level data is stored smallest level first, each
+ * level aligned to its block size.
+ */
+class KTX2 {
+public:
+    static const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+    static const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+
+    static bool isKTX2(const char* data, size_t size) {
+        return size >= sizeof(IDENTIFIER) && memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) == 0;
+    }
+
+    static bool write(const std::string& path, const TextureImage& image) {
+        uint32_t vkFormat = image.format == FORMAT_BC1 ? VK_FORMAT_BC1_RGB_UNORM_BLOCK
+                          : image.format == FORMAT_BC3 ? VK_FORMAT_BC3_UNORM_BLOCK : 0;
+        if(!vkFormat) {
+            std::cout << "ERROR::KTX2::UNSUPPORTED_FORMAT " << path << std::endl;
+            return false;
+        }
+
+        std::vector<uint32_t> dfd = descriptor(image.format);
+        uint32_t dfdOffset = (uint32_t)(HEADER_SIZE + LEVEL_INDEX_ENTRY * image.levels);
+        uint32_t dfdLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+
+        std::vector<uint64_t> levelIndex(image.levels * 3);
+        size_t alignment = TextureImage::blockBytes(image.format);
+        size_t offset = dfdOffset + dfdLength;
+        for(int level = image.levels - 1; level >= 0; level--) {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            levelIndex[level * 3] = offset;
+            levelIndex[level * 3 + 1] = image.levelSize(level);
+            levelIndex[level * 3 + 2] = image.levelSize(level);
+            offset += image.levelSize(level);
+        }
+
+        std::vector<unsigned char> file(offset, 0);
+        uint32_t header[9] = { vkFormat, 1, (uint32_t)image.width, (uint32_t)image.height, 0, 0, 1, (uint32_t)image.levels, 0 };
+        uint32_t index[4] = { dfdOffset, dfdLength, 0, 0 };
+        uint64_t supercompression[2] = { 0, 0 };
+        memcpy(&file[0], IDENTIFIER, sizeof(IDENTIFIER));
+        memcpy(&file[12], header, sizeof(header));
+        memcpy(&file[48], index, sizeof(index));
+        memcpy(&file[64], supercompression, sizeof(supercompression));
+        memcpy(&file[HEADER_SIZE], levelIndex.data(), levelIndex.size() * sizeof(uint64_t));
+        memcpy(&file[dfdOffset], dfd.data(), dfdLength);
+        for(int level = 0; level < image.levels; level++) {
+            memcpy(&file[levelIndex[level * 3]], image.level(level), image.levelSize(level));
+        }
+
+        FILE* out = fopen(path.c_str(), "wb");
+        bool ok = out && fwrite(file.data(), 1, file.size(), out) == file.size();
+        if(out) ok = fclose(out) == 0 && ok;
+        if(!ok) std::cout << "ERROR::KTX2::CANNOT_WRITE " << path << std::endl;
+        return ok;
+    }
+
+    // nullptr and a reason when the file isn't one this reader handles
+    static std::unique_ptr<TextureImage> read(const char* data, size_t size, std::string& error) {
+        if(!isKTX2(data, size) || size < HEADER_SIZE) {
+            error = "not a KTX2 file";
+            return nullptr;
+        }
+        uint32_t header[9];
+        memcpy(header, data + 12, sizeof(header));
+        TextureFormat format = header[0] == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? FORMAT_BC1 : FORMAT_BC3;
+        if(header[0] != VK_FORMAT_BC1_RGB_UNORM_BLOCK && header[0] != VK_FORMAT_BC3_UNORM_BLOCK) {
+            error = "unsupported vkFormat " + std::to_string(header[0]);
+            return nullptr;
+        }
+        int width = (int)header[2], height = (int)header[3], levels = (int)header[7];
+        if(width <= 0 || height <= 0 || header[4] != 0 || header[5] != 0 || header[6] != 1 || header[8] != 0
+           || levels != TextureImage::levelCount(width, height)) {
+            error = "only single 2D images with a full mip chain are supported";
+            return nullptr;
+        }
+        if(size < HEADER_SIZE + LEVEL_INDEX_ENTRY * levels) {
+            error = "truncated level index";
+            return nullptr;
+        }
+
+        std::vector<unsigned char> bytes(TextureImage::chainSize(format, width, height));
+        size_t packed = 0;
+        for(int level = 0; level < levels; level++) {
+            uint64_t entry[3];
+            memcpy(entry, data + HEADER_SIZE + LEVEL_INDEX_ENTRY * level, sizeof(entry));
+            size_t expected = TextureImage::levelSize(format, std::max(1, width >> level), std::max(1, height >> level));
+            if(entry[1] != expected || entry[0] > size || size - entry[0] < expected) {
+                error = "bad level " + std::to_string(level);
+                return nullptr;
+            }
+            memcpy(&bytes[packed], data + entry[0], expected);
+            packed += expected;
+        }
+        return TextureImage::fromBytes(std::move(bytes), format, width, height, levels);
+    }
+
+private:
+    static constexpr unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    // identifier, 9 header words, dfd/kvd/sgd index
+    static const size_t HEADER_SIZE = 80;
+    static const size_t LEVEL_INDEX_ENTRY = 3 * sizeof(uint64_t);
+
+    // Khronos basic data format descriptor for an unsigned, linear BC1/BC3 texture
+    static std::vector<uint32_t> descriptor(TextureFormat format) {
+        const uint32_t MODEL_BC1A = 128, MODEL_BC3 = 130;
+        const uint32_t CHANNEL_COLOR = 0, CHANNEL_BC3_ALPHA = 15;
+        bool bc3 = format == FORMAT_BC3;
+        uint32_t samples = bc3 ? 2 : 1;
+        uint32_t blockSize = 24 + 16 * samples;
+
+        std::vector<uint32_t> words = {
+            4 + blockSize,
+            0,                                      // vendor Khronos, basic descriptor
+            2 | blockSize << 16,                    // version 1.3
+            (bc3 ? MODEL_BC3 : MODEL_BC1A) | 1 << 8 | 1 << 16, // BT.709 primaries, linear transfer
+            3 | 3 << 8,                             // 4x4x1x1 texel block
+            (uint32_t)TextureImage::blockBytes(format),
+            0,
+        };
+        auto sample = [&](uint32_t bitOffset, uint32_t channel) {
+            words.insert(words.end(), { bitOffset | 63u << 16 | channel << 24, 0u, 0u, 0xFFFFFFFFu });
+        };
+        if(bc3) {
+            sample(0, CHANNEL_BC3_ALPHA);
+            sample(64, CHANNEL_COLOR);
+        } else {
+            sample(0, CHANNEL_COLOR);
+        }
+        return words;
+    }
+};
+#endif
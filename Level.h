@@ -0,0 +1,130 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+
+/*
+ * Plain description of a level: wall quads, the cells (rooms) they bound and
+ * the portals (openings) between cells. Kept free of GL so offline tools can
+ * read it too.
+ */
+
+// quad p1, p2, p3, p3 - (p2 - p1), same convention as Wall
+struct WallDesc {
+    const char* name;
+    glm::vec3 p1, p2, p3;
+    const char* texture = "stone_tile.jpg";
+    // a .vtex (texture_tool vtex) spread once over the whole wall, texture is used if it can't be opened
+    const char* virtualTexture = nullptr;
+};
+
+// front is the cell on the side of cross(p2 - p1, p3 - p1)
+struct PortalDesc {
+    glm::vec3 p1, p2, p3;
+    int front;
+    int back;
+};
+
+// a cell with empty bounds catches every point outside the other cells
+struct CellDesc {
+    const char* name;
+    AABB bounds;
+    std::vector<int> walls;
+};
+
+struct LevelDesc {
+    std::vector<WallDesc> walls;
+    std::vector<CellDesc> cells;
+    std::vector<PortalDesc> portals;
+    // lay down depth first so the lighting pass shades each pixel once,
+    // worth it when walls overlap a lot on screen
+    bool depthPrepass = false;
+
+    int cellAt(const glm::vec3& point) const {
+        int fallback = -1;
+        for(size_t i = 0; i < cells.size(); i++) {
+            if(cells[i].bounds.isEmpty()) {
+                fallback = (int)i;
+            } else if(cells[i].bounds.contains(point)) {
+                return (int)i;
+            }
+        }
+        return fallback;
+    }
+
+    // FNV-1a over every wall and portal corner, all the BSP is compiled from;
+    // level.bsp keeps it so moving a wall makes the baked file stale
+    uint64_t geometryHash() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const glm::vec3& p) {
+            const unsigned char* bytes = (const unsigned char*)&p[0];
+            for(size_t i = 0; i < sizeof(float) * 3; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+        };
+        for(auto& w : walls) {
+            add(w.p1);
+            add(w.p2);
+            add(w.p3);
+        }
+        for(auto& p : portals) {
+            add(p.p1);
+            add(p.p2);
+            add(p.p3);
+        }
+        return hash;
+    }
+};
+
+inline std::vector<glm::vec3> quadPoints(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+    return std::vector<glm::vec3>{ p1, p2, p3, p3 - (p2 - p1) };
+}
+
+/*
+ * Two rooms joined by door gaps and a ramp tunnel. The rooms have no ceiling,
+ * so each one also has a portal through its open top into the sky cell, which
+ * holds every wall that can be seen from outside.
+ */
+inline LevelDesc defaultLevel() {
+    LevelDesc level;
+    level.walls = {
+        { "floor",       glm::vec3(-5, 0, -5), glm::vec3(-5, 0,  5), glm::vec3( 5, 0,  5) },
+        { "wall1",       glm::vec3(-5, 0, -5), glm::vec3(-5, 0,  5), glm::vec3(-5, 3,  5) },
+        { "wall2",       glm::vec3(-5, 0,  5), glm::vec3( 5, 0,  5), glm::vec3( 5, 3,  5) },
+        { "wall3",       glm::vec3( 5, 0, -5), glm::vec3(-5, 0, -5), glm::vec3(-5, 3, -5) },
+        { "floor2",      glm::vec3(10, 2, -5), glm::vec3(10, 2,  5), glm::vec3(30, 2,  5), "stone_tile.jpg", "floor2.vtex" },
+        { "wall4",       glm::vec3(30, 2, -5), glm::vec3(30, 2,  5), glm::vec3(30, 5,  5) },
+        { "wall5",       glm::vec3(10, 2,  5), glm::vec3(30, 2,  5), glm::vec3(30, 5,  5) },
+        { "wall6",       glm::vec3(10, 2, -5), glm::vec3(30, 2, -5), glm::vec3(30, 5, -5) },
+        { "gapWall1",    glm::vec3( 5, 0,  5), glm::vec3( 5, 0,  2), glm::vec3( 5, 3,  2) },
+        { "gapWall2",    glm::vec3( 5, 0, -5), glm::vec3( 5, 0, -2), glm::vec3( 5, 3, -2) },
+        { "gapWall3",    glm::vec3(10, 2,  5), glm::vec3(10, 2,  2), glm::vec3(10, 5,  2) },
+        { "gapWall4",    glm::vec3(10, 2, -5), glm::vec3(10, 2, -2), glm::vec3(10, 5, -2) },
+        { "ramp",        glm::vec3( 5, 0,  2), glm::vec3(10, 2,  2), glm::vec3(10, 2, -2), "textures/container.jpg" },
+        { "tunnelWall1", glm::vec3( 5, 0,  2), glm::vec3(10, 2,  2), glm::vec3(10, 5,  2) },
+        { "tunnelWall2", glm::vec3( 5, 0, -2), glm::vec3(10, 2, -2), glm::vec3(10, 5, -2) },
+    };
+
+    enum { ROOM1, TUNNEL, ROOM2, SKY };
+    level.cells = {
+        { "room1",  AABB(glm::vec3(-5, -1, -5), glm::vec3( 5, 3, 5)), { 0, 1, 2, 3, 8, 9 } },
+        { "tunnel", AABB(glm::vec3( 5, -1, -2), glm::vec3(10, 5, 2)), { 12, 13, 14 } },
+        { "room2",  AABB(glm::vec3(10,  1, -5), glm::vec3(30, 5, 5)), { 4, 5, 6, 7, 10, 11 } },
+        { "sky",    AABB(), { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 } },
+    };
+
+    level.portals = {
+        // door gaps, normals face -x
+        { glm::vec3( 5, 0, -2), glm::vec3( 5, 0, 2), glm::vec3( 5, 3, 2), ROOM1,  TUNNEL },
+        { glm::vec3(10, 2, -2), glm::vec3(10, 2, 2), glm::vec3(10, 5, 2), TUNNEL, ROOM2 },
+        // open tops, normals face up
+        { glm::vec3(-5, 3, -5), glm::vec3(-5, 3, 5), glm::vec3( 5, 3, 5), SKY, ROOM1 },
+        { glm::vec3( 5, 3, -2), glm::vec3( 5, 3, 2), glm::vec3(10, 5, 2), SKY, TUNNEL },
+        { glm::vec3(10, 5, -5), glm::vec3(10, 5, 5), glm::vec3(30, 5, 5), SKY, ROOM2 },
+    };
+    // the rooms are seen through each other's doors and open tops
+    level.depthPrepass = true;
+    return level;
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "TextureManager.h"
+#include "VirtualTextures.h"
+
+// what a surface is drawn with; textures are shared through TextureManager
+struct Material {
+    TextureHandle diffuse;
+    // when diffuse is a texture array (MaterialPacker.h)
+    int layer = 0;
+    // index in VirtualTextures, used instead of diffuse; -1 for none
+    int virtualTexture = -1;
+
+    void bind() const {
+        if(virtualTexture >= 0) virtualTextures().bind(virtualTexture, 0);
+        else textureManager().bind(diffuse, 0);
+    }
+};
+#endif
@@ -0,0 +1,48 @@
+#ifndef MATERIAL_PACKER_H
+#define MATERIAL_PACKER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TextureManager.h"
+
+/*
+ * Packs the diffuse textures of many materials into the layers of one
+ * GL_TEXTURE_2D_ARRAY, so surfaces with different textures still share a
+ * binding and can go out in a single draw call. Each material keeps the
+ * array and its layer, and the layer reaches the shader as a vertex attribute
+ * (Vertex::Layer, the TEXTURE_ARRAY shader feature).
+ *
+ * Layers all have layerSize x layerSize texels. Images of another size are
+ * resampled while they load, so levels should stick to one texture size. An
+ * array has one mip chain per layer, which keeps mipmapping exact; an atlas
+ * would need padding between its tiles instead.
+ */
+class MaterialPacker {
+public:
+    int layerSize = 512;
+
+    // the layer path will be in, the same path always gets the same layer
+    int add(const std::string& path) {
+        auto it = layers.find(path);
+        if(it != layers.end()) return it->second;
+        int layer = (int)paths.size();
+        layers[path] = layer;
+        paths.push_back(path);
+        return layer;
+    }
+
+    int layerCount() const {
+        return (int)paths.size();
+    }
+
+    // +1 reference to an array holding every added texture, loading in the background
+    TextureHandle pack() const {
+        return textureManager().loadArray(paths, layerSize, layerSize);
+    }
+
+private:
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, int> layers;
+};
+#endif
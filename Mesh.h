@@ -4,7 +4,6 @@
 #include <vector>
 #include <glm/glm.hpp>
 #include "shader.h"
-#include "stb_image.h"
 
 using namespace std;
 
@@ -12,6 +11,8 @@ struct Vertex {
     glm::vec3 Position;
     glm::vec3 Normal;
     glm::vec2 TexCoords; 
+    // texture array layer, see MaterialPacker.h
+    float Layer = 0.0f;
 };
 
 class Mesh {
@@ -56,25 +57,25 @@ public:
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)offsetof(Vertex, TexCoords));
         glEnableVertexAttribArray(2);
 
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Layer));
+        glEnableVertexAttribArray(3);
+
         glBindVertexArray(0);
     }
 
     void draw(Shader& shader) {
         shader.use();
+        drawGeometry();
+    }
+
+    // with whatever program is bound
+    void drawGeometry() {
         glBindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);  
     }
 
-    void loadTexture() {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-        int width, height, nrChannels;
-        unsigned char* data = stbi_load(this->textureUrl, &width, &height, &nrChannels, 0);
-        if(data) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-
+    // repeats the texture along the longer side instead of stretching it
+    void fitTexCoords() {
 	    double side1 = getSide1();
 	    double side2 = getSide2();
 
@@ -87,21 +88,10 @@ public:
 		vertices[3].TexCoords.y = 1 / ratio;
 	    }
 	    setup();
-        } else {
-            std::cout << "Failed to load texture" << std::endl;
-        }
-        stbi_image_free(data);
-    }
-
-    void setTexture(const char* url) {
-        this->textureUrl = url;
-        loadTexture();
     }
 private:
     unsigned int VAO, VBO, EBO;
 
-    const char* textureUrl;
-
     string colorUniform = "objectColor";
     string textureUniform = "myTexture";
 
@@ -0,0 +1,359 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// one RGBA texel of linear floats, the unit every filter works in
+#if defined(__SSE2__)
+typedef __m128 Texel4;
+inline Texel4 texelLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void texelStore(float* p, Texel4 v) { _mm_storeu_ps(p, v); }
+inline Texel4 texelAdd(Texel4 a, Texel4 b) { return _mm_add_ps(a, b); }
+inline Texel4 texelScale(Texel4 a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+inline Texel4 texelZero() { return _mm_setzero_ps(); }
+#elif defined(__ARM_NEON)
+typedef float32x4_t Texel4;
+inline Texel4 texelLoad(const float* p) { return vld1q_f32(p); }
+inline void texelStore(float* p, Texel4 v) { vst1q_f32(p, v); }
+inline Texel4 texelAdd(Texel4 a, Texel4 b) { return vaddq_f32(a, b); }
+inline Texel4 texelScale(Texel4 a, float s) { return vmulq_n_f32(a, s); }
+inline Texel4 texelZero() { return vdupq_n_f32(0.0f); }
+#else
+struct Texel4 { float v[4]; };
+inline Texel4 texelLoad(const float* p) { return Texel4{ { p[0], p[1], p[2], p[3] } }; }
+inline void texelStore(float* p, Texel4 a) { for(int i = 0; i < 4; i++) p[i] = a.v[i]; }
+inline Texel4 texelAdd(Texel4 a, Texel4 b) { for(int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline Texel4 texelScale(Texel4 a, float s) { for(int i = 0; i < 4; i++) a.v[i] *= s; return a; }
+inline Texel4 texelZero() { return Texel4{ { 0, 0, 0, 0 } }; }
+#endif
+
+enum MipFilter {
+    // 2x2 average, cheapest
+    MIP_BOX,
+    // separable 8 tap Kaiser-windowed sinc, keeps detail without ringing much
+    MIP_KAISER,
+};
+
+/*
+ * Builds RGB8/RGBA8 mip chains on the CPU. Texels are widened to linear float
+ * RGBA (color decoded from sRGB unless srgb is off, alpha as is), filtered
+ * four channels at a time with SSE2/NEON, and encoded back per level. Each
+ * level is filtered from the one above it in bands of rows; a band starts as
+ * soon as the rows it reads above are done, so the levels overlap rather than
+ * waiting for each other. Bands run on a shared pool and the calling thread.
+ */
+class MipGenerator {
+public:
+    MipFilter filter = MIP_KAISER;
+    bool srgb = true;
+    // 0 uses every core; 1 when already running on a pool worker
+    int threads = 0;
+
+    std::unique_ptr<TextureImage> build(const unsigned char* pixels, int width, int height,
+                                        TextureFormat format = FORMAT_RGB8) const {
+        Chain chain;
+        chain.pixels = pixels;
+        chain.channels = TextureImage::channels(format);
+        int levels = TextureImage::levelCount(width, height);
+        std::vector<unsigned char> bytes(TextureImage::chainSize(format, width, height));
+        std::copy(pixels, pixels + (size_t)width * height * chain.channels, bytes.begin());
+
+        chain.levels.resize(levels);
+        unsigned char* out = bytes.data();
+        for(int i = 0; i < levels; i++) {
+            Level& level = chain.levels[i];
+            level.width = i == 0 ? width : std::max(1, chain.levels[i - 1].width / 2);
+            level.height = i == 0 ? height : std::max(1, chain.levels[i - 1].height / 2);
+            level.out = out;
+            out += (size_t)level.width * level.height * chain.channels;
+            level.texels.resize((size_t)level.width * level.height * 4);
+            if(filter == MIP_KAISER && i + 1 < levels) {
+                level.horizontal.resize((size_t)std::max(1, level.width / 2) * level.height * 4);
+            }
+            int bands = (level.height + BAND_ROWS - 1) / BAND_ROWS;
+            level.done.assign(bands, 0);
+            for(int band = 0; band < bands; band++) chain.tasks.push_back({ i, band });
+        }
+        run(chain);
+        return TextureImage::fromBytes(std::move(bytes), format, width, height, levels);
+    }
+
+    // bilinear, for fitting the odd image to a texture array's layer size; missing alpha is opaque
+    static std::vector<unsigned char> resize(const unsigned char* pixels, int width, int height, int channels,
+                                             int dstWidth, int dstHeight, int dstChannels) {
+        std::vector<unsigned char> out((size_t)dstWidth * dstHeight * dstChannels);
+        for(int y = 0; y < dstHeight; y++) {
+            float sy = std::max(0.0f, (y + 0.5f) * height / dstHeight - 0.5f);
+            int y0 = std::min((int)sy, height - 1), y1 = std::min(y0 + 1, height - 1);
+            float fy = sy - y0;
+            for(int x = 0; x < dstWidth; x++) {
+                float sx = std::max(0.0f, (x + 0.5f) * width / dstWidth - 0.5f);
+                int x0 = std::min((int)sx, width - 1), x1 = std::min(x0 + 1, width - 1);
+                float fx = sx - x0;
+                unsigned char* dst = out.data() + ((size_t)y * dstWidth + x) * dstChannels;
+                for(int c = 0; c < dstChannels; c++) {
+                    if(c >= channels) {
+                        dst[c] = 255;
+                        continue;
+                    }
+                    auto at = [&](int px, int py) { return (float)pixels[((size_t)py * width + px) * channels + c]; };
+                    float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+                    float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+                    dst[c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    static const int TAPS = 8;
+    static const int BAND_ROWS = 32;
+
+    struct Level {
+        int width, height;
+        unsigned char* out;
+        std::vector<float> texels;
+        // Kaiser only: the rows already filtered across to the next level's width
+        std::vector<float> horizontal;
+        std::vector<char> done;
+    };
+
+    struct Chain {
+        const unsigned char* pixels;
+        int channels;
+        std::vector<Level> levels;
+        // (level, band) in level order, so a band only ever waits on ones taken before it
+        std::vector<std::pair<int, int>> tasks;
+        size_t next = 0;
+        int running = 0;
+        std::mutex mutex;
+        std::condition_variable bandDone;
+    };
+
+    // shared by every generator, spun up by the first build that spreads out
+    static ThreadPool& pool() {
+        static ThreadPool workers;
+        return workers;
+    }
+
+    void run(Chain& chain) const {
+        int count = threads > 0 ? threads : (int)std::max(1u, std::thread::hardware_concurrency());
+        count = std::min(count, (int)chain.tasks.size());
+        if(count > 1) count = std::min(count, (int)pool().size() + 1);
+
+        chain.running = count - 1;
+        for(int i = 1; i < count; i++) {
+            pool().submit([this, &chain]() {
+                runTasks(chain);
+                std::lock_guard<std::mutex> lock(chain.mutex);
+                if(--chain.running == 0) chain.bandDone.notify_all();
+            });
+        }
+        runTasks(chain);
+        std::unique_lock<std::mutex> lock(chain.mutex);
+        chain.bandDone.wait(lock, [&]() { return chain.running == 0; });
+    }
+
+    void runTasks(Chain& chain) const {
+        while(true) {
+            std::pair<int, int> task;
+            {
+                std::lock_guard<std::mutex> lock(chain.mutex);
+                if(chain.next == chain.tasks.size()) return;
+                task = chain.tasks[chain.next++];
+            }
+            runBand(chain, task.first, task.second);
+            {
+                std::lock_guard<std::mutex> lock(chain.mutex);
+                chain.levels[task.first].done[task.second] = 1;
+            }
+            chain.bandDone.notify_all();
+        }
+    }
+
+    // blocks until rows first..last of the level are filtered
+    void waitRows(Chain& chain, int level, int first, int last) const {
+        const std::vector<char>& done = chain.levels[level].done;
+        std::unique_lock<std::mutex> lock(chain.mutex);
+        chain.bandDone.wait(lock, [&]() {
+            for(int band = first / BAND_ROWS; band <= last / BAND_ROWS; band++) {
+                if(!done[band]) return false;
+            }
+            return true;
+        });
+    }
+
+    void runBand(Chain& chain, int index, int band) const {
+        Level& level = chain.levels[index];
+        int begin = band * BAND_ROWS, end = std::min(level.height, begin + BAND_ROWS);
+        if(index == 0) {
+            decode(chain.pixels, level.width, chain.channels, begin, end, level.texels.data());
+        } else {
+            const Level& above = chain.levels[index - 1];
+            if(filter == MIP_BOX) {
+                waitRows(chain, index - 1, std::min(2 * begin, above.height - 1), std::min(2 * end - 1, above.height - 1));
+                downsampleBox(above.texels.data(), above.width, above.height, level.texels.data(), begin, end);
+            } else {
+                waitRows(chain, index - 1, std::max(2 * begin - TAPS / 2 + 1, 0),
+                         std::min(2 * (end - 1) + TAPS / 2, above.height - 1));
+                kaiserVertical(above.horizontal.data(), level.width, above.height, level.texels.data(), begin, end);
+            }
+            encode(level.texels.data(), level.width, chain.channels, begin, end, level.out);
+        }
+        if(!level.horizontal.empty()) {
+            kaiserHorizontal(level.texels.data(), level.width, level.horizontal.data(), begin, end);
+        }
+    }
+
+    void decode(const unsigned char* pixels, int width, int channels, int begin, int end, float* out) const {
+        const float* toLinear = srgbToLinear();
+        for(int y = begin; y < end; y++) {
+            const unsigned char* src = pixels + (size_t)y * width * channels;
+            float* dst = out + (size_t)y * width * 4;
+            for(int x = 0; x < width; x++, src += channels, dst += 4) {
+                for(int c = 0; c < 3; c++) dst[c] = srgb ? toLinear[src[c]] : src[c] / 255.0f;
+                dst[3] = channels == 4 ? src[3] / 255.0f : 1.0f;
+            }
+        }
+    }
+
+    void encode(const float* texels, int width, int channels, int begin, int end, unsigned char* out) const {
+        const unsigned char* toSrgb = linearToSrgb();
+        for(int y = begin; y < end; y++) {
+            const float* src = texels + (size_t)y * width * 4;
+            unsigned char* dst = out + (size_t)y * width * channels;
+            for(int x = 0; x < width; x++, src += 4, dst += channels) {
+                for(int c = 0; c < channels; c++) {
+                    float v = std::min(1.0f, std::max(0.0f, src[c]));
+                    dst[c] = srgb && c < 3 ? toSrgb[(int)(v * (SRGB_TABLE_SIZE - 1) + 0.5f)]
+                                           : (unsigned char)(v * 255.0f + 0.5f);
+                }
+            }
+        }
+    }
+
+    // destination rows begin..end; odd sizes repeat their last row/column
+    static void downsampleBox(const float* src, int width, int height, float* dst, int begin, int end) {
+        int dstWidth = std::max(1, width / 2);
+        for(int y = begin; y < end; y++) {
+            const float* row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+            const float* row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+            float* out = dst + (size_t)y * dstWidth * 4;
+            for(int x = 0; x < dstWidth; x++) {
+                int x0 = std::min(2 * x, width - 1) * 4, x1 = std::min(2 * x + 1, width - 1) * 4;
+                Texel4 sum = texelAdd(texelAdd(texelLoad(row0 + x0), texelLoad(row0 + x1)),
+                                      texelAdd(texelLoad(row1 + x0), texelLoad(row1 + x1)));
+                texelStore(out + x * 4, texelScale(sum, 0.25f));
+            }
+        }
+    }
+
+    // the Kaiser filter is separable: source rows begin..end across into a half-width buffer; edges clamp
+    static void kaiserHorizontal(const float* src, int width, float* dst, int begin, int end) {
+        const float* weights = kaiserWeights();
+        int dstWidth = std::max(1, width / 2);
+        for(int y = begin; y < end; y++) {
+            const float* row = src + (size_t)y * width * 4;
+            float* out = dst + (size_t)y * dstWidth * 4;
+            for(int x = 0; x < dstWidth; x++) {
+                Texel4 sum = texelZero();
+                for(int k = 0; k < TAPS; k++) {
+                    int sx = std::min(std::max(2 * x - TAPS / 2 + 1 + k, 0), width - 1);
+                    sum = texelAdd(sum, texelScale(texelLoad(row + sx * 4), weights[k]));
+                }
+                texelStore(out + x * 4, sum);
+            }
+        }
+    }
+
+    // then down: destination rows begin..end from the horizontal buffer of a level height rows tall
+    static void kaiserVertical(const float* horizontal, int dstWidth, int height, float* dst, int begin, int end) {
+        const float* weights = kaiserWeights();
+        for(int y = begin; y < end; y++) {
+            const float* rows[TAPS];
+            for(int k = 0; k < TAPS; k++) {
+                int sy = std::min(std::max(2 * y - TAPS / 2 + 1 + k, 0), height - 1);
+                rows[k] = horizontal + (size_t)sy * dstWidth * 4;
+            }
+            float* out = dst + (size_t)y * dstWidth * 4;
+            for(int x = 0; x < dstWidth; x++) {
+                Texel4 sum = texelZero();
+                for(int k = 0; k < TAPS; k++) sum = texelAdd(sum, texelScale(texelLoad(rows[k] + x * 4), weights[k]));
+                texelStore(out + x * 4, sum);
+            }
+        }
+    }
+
+    // taps sit at -3.5..3.5 source texels around the destination texel's center
+    static const float* kaiserWeights() {
+        static const std::vector<float> weights = []() {
+            const double BETA = 4.0, RADIUS = TAPS / 2.0;
+            auto besselI0 = [](double x) {
+                double sum = 1.0, term = 1.0;
+                for(int k = 1; k < 20; k++) {
+                    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                    sum += term;
+                }
+                return sum;
+            };
+            std::vector<float> w(TAPS);
+            double total = 0.0;
+            for(int k = 0; k < TAPS; k++) {
+                double d = k - (TAPS - 1) / 2.0;
+                double t = d / 2.0;
+                double sinc = std::sin(M_PI * t) / (M_PI * t);
+                double window = besselI0(BETA * std::sqrt(1.0 - (d / RADIUS) * (d / RADIUS))) / besselI0(BETA);
+                w[k] = (float)(sinc * window);
+                total += w[k];
+            }
+            for(float& v : w) v = (float)(v / total);
+            return w;
+        }();
+        return weights.data();
+    }
+
+    static const int SRGB_TABLE_SIZE = 16384;
+
+    static const float* srgbToLinear() {
+        static const std::vector<float> table = []() {
+            std::vector<float> t(256);
+            for(int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                t[i] = (float)(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    static const unsigned char* linearToSrgb() {
+        static const std::vector<unsigned char> table = []() {
+            std::vector<unsigned char> t(SRGB_TABLE_SIZE);
+            for(int i = 0; i < SRGB_TABLE_SIZE; i++) {
+                double l = (double)i / (SRGB_TABLE_SIZE - 1);
+                double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+                t[i] = (unsigned char)(c * 255.0 + 0.5);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+};
+#endif
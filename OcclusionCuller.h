@@ -0,0 +1,354 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// the AVX2 spans are compiled per function and picked at runtime, no -mavx2 needed
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define OCCLUSION_AVX2 __attribute__((target("avx2")))
+#endif
+
+/*
+ * CPU occlusion culling against a small software depth buffer. Big occluder
+ * quads are rasterized with SIMD spans (8 pixels with AVX2 when the CPU has
+ * it, 4 with SSE2, scalar otherwise), then occludee boxes are projected to a
+ * screen rectangle at their nearest depth and count as visible if any pixel
+ * in that rectangle is further away. Nothing here touches GL so it runs
+ * headless.
+ */
+
+namespace occlusion {
+
+    // rows are padded and aligned for the widest spans, whichever width runs
+    const int MAX_LANES = 8;
+
+#if defined(__SSE2__)
+    const int LANES = 4;
+    typedef __m128 Floats;
+    inline Floats splat(float f) { return _mm_set1_ps(f); }
+    inline Floats ramp() { return _mm_setr_ps(0, 1, 2, 3); }
+    inline Floats load(const float* p) { return _mm_load_ps(p); }
+    inline void store(float* p, Floats v) { _mm_store_ps(p, v); }
+    inline Floats add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+    inline Floats mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+    inline Floats lesser(Floats a, Floats b) { return _mm_min_ps(a, b); }
+    inline Floats above(Floats a, Floats b) { return _mm_cmpgt_ps(a, b); }
+    inline Floats atLeast(Floats a, Floats b) { return _mm_cmpge_ps(a, b); }
+    inline Floats both(Floats a, Floats b) { return _mm_and_ps(a, b); }
+    inline Floats select(Floats mask, Floats a, Floats b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    inline int bits(Floats mask) { return _mm_movemask_ps(mask); }
+#else
+    const int LANES = 1;
+    typedef float Floats;
+    inline Floats splat(float f) { return f; }
+    inline Floats ramp() { return 0.0f; }
+    inline Floats load(const float* p) { return *p; }
+    inline void store(float* p, Floats v) { *p = v; }
+    inline Floats add(Floats a, Floats b) { return a + b; }
+    inline Floats mul(Floats a, Floats b) { return a * b; }
+    inline Floats lesser(Floats a, Floats b) { return a < b ? a : b; }
+    // masks are 0 or 1 in the scalar build
+    inline Floats above(Floats a, Floats b) { return a > b ? 1.0f : 0.0f; }
+    inline Floats atLeast(Floats a, Floats b) { return a >= b ? 1.0f : 0.0f; }
+    inline Floats both(Floats a, Floats b) { return a * b; }
+    inline Floats select(Floats mask, Floats a, Floats b) { return mask != 0.0f ? a : b; }
+    inline int bits(Floats mask) { return mask != 0.0f; }
+#endif
+
+#if defined(OCCLUSION_AVX2)
+    inline bool cpuHasAvx2() {
+        static const bool has = __builtin_cpu_supports("avx2");
+        return has;
+    }
+
+    /*
+     * The two span loops of OcclusionCuller spelled out 8 wide. They can't
+     * share the helpers above: those are compiled for the baseline target,
+     * and 256-bit values can't cross into them.
+     */
+    OCCLUSION_AVX2 inline void fillTriangleAvx2(float* depth, int stride, int x0, int y0, int x1, int y1,
+                                                const glm::vec3* edges, float zx, float zy, float z0) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 step = _mm256_set1_ps(8.0f);
+        int spanStart = x0 / 8 * 8;
+        for(int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            float* row = depth + y * stride;
+            __m256 px = _mm256_add_ps(_mm256_set1_ps(spanStart + 0.5f), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+            for(int x = spanStart; x <= x1; x += 8, px = _mm256_add_ps(px, step)) {
+                __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edges[0].x), px), _mm256_set1_ps(edges[0].y * py + edges[0].z));
+                __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edges[1].x), px), _mm256_set1_ps(edges[1].y * py + edges[1].z));
+                __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edges[2].x), px), _mm256_set1_ps(edges[2].y * py + edges[2].z));
+                __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ), _mm256_cmp_ps(e1, zero, _CMP_GT_OQ)),
+                                              _mm256_cmp_ps(e2, zero, _CMP_GT_OQ));
+                if(!_mm256_movemask_ps(inside)) continue;
+
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(zx), px), _mm256_set1_ps(zy * py + z0));
+                __m256 current = _mm256_load_ps(row + x);
+                _mm256_store_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+            }
+        }
+    }
+
+    OCCLUSION_AVX2 inline bool anyFurtherAvx2(const float* depth, int stride, int x0, int y0, int x1, int y1, float nearest) {
+        const __m256 z = _mm256_set1_ps(nearest);
+        int spanStart = x0 / 8 * 8;
+        for(int y = y0; y <= y1; y++) {
+            const float* row = depth + y * stride;
+            for(int x = spanStart; x <= x1; x += 8) {
+                int mask = 0xFF;
+                if(x < x0) mask &= ~((1 << (x0 - x)) - 1);
+                if(x + 7 > x1) mask &= (1 << (x1 - x + 1)) - 1;
+                if(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(row + x), z, _CMP_GE_OQ)) & mask) return true;
+            }
+        }
+        return false;
+    }
+#else
+    inline bool cpuHasAvx2() { return false; }
+#endif
+
+}
+
+class OcclusionCuller {
+public:
+    // occludees only get split across threads when there are this many per thread
+    size_t boxesPerThread = 64;
+    // 8-wide spans when the CPU has AVX2; false forces the baseline ones, e.g. to compare them
+    bool avx2 = occlusion::cpuHasAvx2();
+
+    OcclusionCuller(int width = 256, int height = 128) : width(width), height(height) {
+        // pad rows to whole SIMD spans so spans never need a scalar tail
+        stride = (width + occlusion::MAX_LANES - 1) / occlusion::MAX_LANES * occlusion::MAX_LANES;
+        storage.resize(stride * height + occlusion::MAX_LANES);
+        clear();
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // depth in [0, 1], 1 is the far plane
+    float depthAt(int x, int y) const { return depth()[y * stride + x]; }
+
+    void clear() {
+        std::fill(storage.begin(), storage.end(), 1.0f);
+    }
+
+    void setViewProjection(const glm::mat4& viewProjection) {
+        this->viewProjection = viewProjection;
+    }
+
+    // quad in the Wall convention: p1, p2, p3, p3 - (p2 - p1)
+    void rasterizeQuad(const std::vector<glm::vec3>& quad) {
+        rasterizeTriangle(quad[0], quad[1], quad[3]);
+        rasterizeTriangle(quad[1], quad[2], quad[3]);
+    }
+
+    void rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        std::vector<glm::vec4> polygon = {
+            viewProjection * glm::vec4(a, 1.0f),
+            viewProjection * glm::vec4(b, 1.0f),
+            viewProjection * glm::vec4(c, 1.0f)
+        };
+        polygon = clipNear(polygon);
+        if(polygon.size() < 3) return;
+
+        std::vector<glm::vec3> screen;
+        for(auto& p : polygon) screen.push_back(toScreen(p));
+        for(size_t i = 1; i + 1 < screen.size(); i++) {
+            rasterizeScreenTriangle(screen[0], screen[i], screen[i + 1]);
+        }
+    }
+
+    bool isVisible(const AABB& box) const {
+        float minX = (float)width, minY = (float)height, maxX = 0.0f, maxY = 0.0f;
+        float minZ = 1.0f;
+        for(int i = 0; i < 8; i++) {
+            glm::vec3 corner(
+                i & 1 ? box.max.x : box.min.x,
+                i & 2 ? box.max.y : box.min.y,
+                i & 4 ? box.max.z : box.min.z
+            );
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+            // box reaches behind the near plane, can't be ruled out
+            if(clip.z < -clip.w || clip.w <= 0.0f) return true;
+            glm::vec3 s = toScreen(clip);
+            minX = std::min(minX, s.x);
+            maxX = std::max(maxX, s.x);
+            minY = std::min(minY, s.y);
+            maxY = std::max(maxY, s.y);
+            minZ = std::min(minZ, s.z);
+        }
+
+        int x0 = std::max(0, (int)std::floor(minX));
+        int y0 = std::max(0, (int)std::floor(minY));
+        int x1 = std::min(width - 1, (int)std::floor(maxX));
+        int y1 = std::min(height - 1, (int)std::floor(maxY));
+        if(x0 > x1 || y0 > y1) return false;
+
+#if defined(OCCLUSION_AVX2)
+        if(avx2) return occlusion::anyFurtherAvx2(depth(), stride, x0, y0, x1, y1, minZ);
+#endif
+        using namespace occlusion;
+        Floats nearest = splat(minZ);
+        int spanStart = x0 / LANES * LANES;
+        for(int y = y0; y <= y1; y++) {
+            const float* row = depth() + y * stride;
+            for(int x = spanStart; x <= x1; x += LANES) {
+                int mask = bits(atLeast(load(row + x), nearest)) & spanMask(x, x0, x1);
+                if(mask) return true;
+            }
+        }
+        return false;
+    }
+
+    // visible[i] = isVisible(boxes[i]), spread over the pool and this thread for big batches
+    void testVisibility(const std::vector<AABB>& boxes, std::vector<char>& visible) const {
+        visible.resize(boxes.size());
+        size_t threads = boxes.size() / boxesPerThread;
+        if(threads > 1 && !pool) pool.reset(new ThreadPool());
+        threads = std::min(threads, pool ? pool->size() + 1 : 1);
+        if(threads <= 1) {
+            for(size_t i = 0; i < boxes.size(); i++) visible[i] = isVisible(boxes[i]);
+            return;
+        }
+
+        size_t chunk = (boxes.size() + threads - 1) / threads;
+        auto test = [&](size_t t) {
+            size_t end = std::min(boxes.size(), (t + 1) * chunk);
+            for(size_t i = t * chunk; i < end; i++) visible[i] = isVisible(boxes[i]);
+        };
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = threads - 1;
+        for(size_t t = 1; t < threads; t++) {
+            pool->submit([&, t]() {
+                test(t);
+                std::lock_guard<std::mutex> lock(mutex);
+                if(--remaining == 0) done.notify_one();
+            });
+        }
+        test(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return remaining == 0; });
+    }
+
+private:
+    int width;
+    int height;
+    int stride;
+    std::vector<float> storage;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    // created on the first batch big enough to split, reused every frame after
+    mutable std::unique_ptr<ThreadPool> pool;
+
+    // SIMD loads want the buffer aligned to a whole span
+    float* depth() {
+        const size_t span = occlusion::MAX_LANES * sizeof(float);
+        size_t offset = (size_t)storage.data() % span;
+        return storage.data() + (offset ? (span - offset) / sizeof(float) : 0);
+    }
+    const float* depth() const { return const_cast<OcclusionCuller*>(this)->depth(); }
+
+    // lanes of the span starting at x that fall inside [x0, x1]
+    static int spanMask(int x, int x0, int x1) {
+        int mask = (1 << occlusion::LANES) - 1;
+        if(x < x0) mask &= ~((1 << (x0 - x)) - 1);
+        if(x + occlusion::LANES - 1 > x1) mask &= (1 << (x1 - x + 1)) - 1;
+        return mask;
+    }
+
+    glm::vec3 toScreen(const glm::vec4& clip) const {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3(
+            (ndc.x * 0.5f + 0.5f) * width,
+            (ndc.y * 0.5f + 0.5f) * height,
+            ndc.z * 0.5f + 0.5f
+        );
+    }
+
+    // keep the part of the polygon in front of the near plane (z >= -w)
+    static std::vector<glm::vec4> clipNear(const std::vector<glm::vec4>& polygon) {
+        std::vector<glm::vec4> out;
+        for(size_t i = 0; i < polygon.size(); i++) {
+            const glm::vec4& a = polygon[i];
+            const glm::vec4& b = polygon[(i + 1) % polygon.size()];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+            if(da >= 0) out.push_back(a);
+            if((da >= 0) != (db >= 0)) out.push_back(a + (b - a) * (da / (da - db)));
+        }
+        return out;
+    }
+
+    void rasterizeScreenTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if(std::abs(area) < 1e-8f) return;
+        // walls are two sided, wind everything the same way
+        if(area < 0) {
+            std::swap(b, c);
+            area = -area;
+        }
+
+        int x0 = std::max(0, (int)std::floor(std::min({ a.x, b.x, c.x })));
+        int y0 = std::max(0, (int)std::floor(std::min({ a.y, b.y, c.y })));
+        int x1 = std::min(width - 1, (int)std::ceil(std::max({ a.x, b.x, c.x })));
+        int y1 = std::min(height - 1, (int)std::ceil(std::max({ a.y, b.y, c.y })));
+        if(x0 > x1 || y0 > y1) return;
+
+        // edge functions e(x, y) = A x + B y + C, positive inside
+        glm::vec3 edges[3] = { edge(b, c), edge(c, a), edge(a, b) };
+
+        // depth is linear in screen space: z = zx x + zy y + z0
+        float zx = (edges[0].x * a.z + edges[1].x * b.z + edges[2].x * c.z) / area;
+        float zy = (edges[0].y * a.z + edges[1].y * b.z + edges[2].y * c.z) / area;
+        float z0 = (edges[0].z * a.z + edges[1].z * b.z + edges[2].z * c.z) / area;
+
+#if defined(OCCLUSION_AVX2)
+        if(avx2) {
+            occlusion::fillTriangleAvx2(depth(), stride, x0, y0, x1, y1, edges, zx, zy, z0);
+            return;
+        }
+#endif
+        using namespace occlusion;
+        Floats zero = splat(0.0f);
+        Floats step = splat((float)LANES);
+        int spanStart = x0 / LANES * LANES;
+
+        for(int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            float* row = depth() + y * stride;
+            Floats px = add(splat(spanStart + 0.5f), ramp());
+
+            for(int x = spanStart; x <= x1; x += LANES, px = add(px, step)) {
+                Floats e0 = add(mul(splat(edges[0].x), px), splat(edges[0].y * py + edges[0].z));
+                Floats e1 = add(mul(splat(edges[1].x), px), splat(edges[1].y * py + edges[1].z));
+                Floats e2 = add(mul(splat(edges[2].x), px), splat(edges[2].y * py + edges[2].z));
+                // strictly inside only, occluders must never grow
+                Floats inside = both(both(above(e0, zero), above(e1, zero)), above(e2, zero));
+                if(!bits(inside)) continue;
+
+                Floats z = add(mul(splat(zx), px), splat(zy * py + z0));
+                Floats current = load(row + x);
+                store(row + x, select(inside, lesser(current, z), current));
+            }
+        }
+    }
+
+    static glm::vec3 edge(const glm::vec3& from, const glm::vec3& to) {
+        return glm::vec3(from.y - to.y, to.x - from.x, from.x * to.y - from.y * to.x);
+    }
+};
+#endif
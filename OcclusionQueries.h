@@ -0,0 +1,175 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "AABB.h"
+#include "shader.h"
+
+/*
+ * Hardware occlusion queries with temporal coherence. Results are only ever
+ * read once the GPU says they are available, so deciding what to draw uses
+ * the last finished query and never stalls.
+ *
+ * Every object tracks how many results in a row came back occluded:
+ *   0               visible, drawn normally and re-queried every few frames
+ *   1..hideAfter-1  uncertain, bounding box queried and the object drawn under
+ *                   glBeginConditionalRender so the GPU makes the final call
+ *   hideAfter+      occluded, only the bounding box is queried
+ * A single visible result brings an object straight back, while hiding takes
+ * several occluded results, so objects at occluder edges don't flicker.
+ */
+class OcclusionQueries {
+public:
+    int hideAfter = 3;
+    int requeryInterval = 4;
+
+    void init() {
+        const float corners[] = {
+            -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,   0.5f,  0.5f, -0.5f,  -0.5f,  0.5f, -0.5f,
+            -0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,   0.5f,  0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,
+        };
+        const unsigned int faces[] = {
+            0, 1, 2, 2, 3, 0,   4, 5, 6, 6, 7, 4,   0, 4, 7, 7, 3, 0,
+            1, 5, 6, 6, 2, 1,   0, 1, 5, 5, 4, 0,   3, 2, 6, 6, 7, 3,
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+
+        boxShader.reset(new Shader("./shaders/light_vertex.glsl", "./shaders/light_fragment.glsl"));
+    }
+
+    // camera matrices come from the FrameData block, which must be uploaded already
+    void beginFrame(const glm::vec3& eye) {
+        this->eye = eye;
+        frame++;
+    }
+
+    bool isOccluded(int object) const {
+        return object < (int)states.size() && states[object].occludedStreak >= hideAfter;
+    }
+
+    /*
+     * boundsOf(id) -> AABB, draw(id) draws the object and binds its own program.
+     * Must be called after the main occluders are in the depth buffer.
+     */
+    template<typename BoundsFn, typename DrawFn>
+    void render(const std::vector<int>& objects, BoundsFn boundsOf, DrawFn draw) {
+        for(int id : objects) {
+            State& s = state(id);
+            poll(s);
+
+            // the box would be clipped by the near plane, just treat it as seen
+            AABB box = boundsOf(id);
+            AABB padded(box.min - glm::vec3(nearMargin), box.max + glm::vec3(nearMargin));
+            if(padded.contains(eye)) s.occludedStreak = 0;
+
+            if(s.occludedStreak > 0) continue;
+            if(!s.pending && frame - s.lastQueried >= requeryInterval + id % requeryInterval) {
+                // query the real geometry, no extra box draw for visible objects
+                glBeginQuery(GL_ANY_SAMPLES_PASSED, s.query);
+                draw(id);
+                glEndQuery(GL_ANY_SAMPLES_PASSED);
+                s.pending = true;
+                s.lastQueried = frame;
+            } else {
+                draw(id);
+            }
+        }
+
+        // bounding boxes of everything not known to be visible
+        // boxes never match the depth of a pre-pass, test them with LEQUAL
+        GLint depthFunc;
+        GLboolean depthMask;
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+        glDepthFunc(GL_LEQUAL);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        boxShader->use();
+        glBindVertexArray(boxVAO);
+        for(int id : objects) {
+            State& s = states[id];
+            if(s.occludedStreak == 0 || s.pending) continue;
+
+            AABB box = boundsOf(id);
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), box.center());
+            // flat walls have a zero extent, keep the box from collapsing
+            model = glm::scale(model, glm::max(box.max - box.min, glm::vec3(1e-3f)));
+            boxShader->set(uniforms::model, model);
+
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, s.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            s.pending = true;
+            s.lastQueried = frame;
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(depthFunc);
+        glDepthMask(depthMask);
+
+        // uncertain objects: let the GPU skip them if their last box query saw nothing
+        for(int id : objects) {
+            State& s = states[id];
+            if(s.occludedStreak == 0 || s.occludedStreak >= hideAfter) continue;
+            glBeginConditionalRender(s.query, GL_QUERY_NO_WAIT);
+            draw(id);
+            glEndConditionalRender();
+        }
+    }
+
+private:
+    struct State {
+        GLuint query = 0;
+        bool pending = false;
+        // new objects start out uncertain
+        int occludedStreak = 1;
+        int lastQueried = -1000;
+    };
+
+    std::vector<State> states;
+    std::unique_ptr<Shader> boxShader;
+    unsigned int boxVAO, boxVBO, boxEBO;
+
+    glm::vec3 eye;
+    int frame = 0;
+
+    const float nearMargin = 0.2f;
+
+    State& state(int id) {
+        if(id >= (int)states.size()) states.resize(id + 1);
+        State& s = states[id];
+        if(!s.query) glGenQueries(1, &s.query);
+        return s;
+    }
+
+    // non-blocking, leaves the state alone until the GPU has an answer
+    void poll(State& s) {
+        if(!s.pending) return;
+        GLuint available = 0;
+        glGetQueryObjectuiv(s.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) return;
+
+        GLuint anySamples = 0;
+        glGetQueryObjectuiv(s.query, GL_QUERY_RESULT, &anySamples);
+        s.pending = false;
+        if(anySamples) {
+            s.occludedStreak = 0;
+        } else if(s.occludedStreak < hideAfter) {
+            s.occludedStreak++;
+        }
+    }
+};
+#endif
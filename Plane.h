@@ -43,7 +43,7 @@ public:
         return dot <= 0;
     }
 
-    double signedDistanceTo(const glm::vec3& point) {
+    double signedDistanceTo(const glm::vec3& point) const {
         return dot(point, normal) + equation[3];
     }
 };
@@ -1,6 +1,7 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include "BSP.h"
 #include "Plane.h"
 #include "Wall.h"
 #include "camera.h"
@@ -64,7 +65,9 @@ class Player {
             double tol = 1e-4;
             while(true && glm::length(testVelocity) > tol) {
                 bool is_collision = false;
-                for(Wall obj : colliders) {
+                gatherCandidates(pos, testVelocity);
+                for(int i : candidates) {
+                    Wall& obj = colliders[i];
                     auto collision = collides(obj,
                                               pos, 
                                               testVelocity );
@@ -106,6 +109,11 @@ class Player {
         void addCollider(Wall w) {
             colliders.push_back(w);
         }
+
+        // tree built over the same walls, in the order they were added as colliders
+        void setBroadphase(const BSPTree* tree) {
+            broadphase = tree;
+        }
 private:
     glm::vec3 position;
     glm::vec3 velocity;
@@ -116,6 +124,19 @@ private:
     Camera camera;       
 
     std::vector<Wall> colliders;
+    const BSPTree* broadphase = nullptr;
+    std::vector<int> candidates;
+
+    void gatherCandidates(const glm::vec3 pos, const glm::vec3 vel) {
+        if(broadphase) {
+            // sphere around the whole sweep of the unit collision sphere
+            float radius = glm::length(vel) * 0.5f + 1.0f + 1e-3f;
+            broadphase->queryWalls(pos + vel * 0.5f, radius, candidates);
+            return;
+        }
+        candidates.resize(colliders.size());
+        for(size_t i = 0; i < colliders.size(); i++) candidates[i] = (int)i;
+    }
 
     bool pointInsideTriangle(const glm::vec3 point, const glm::vec3 normal, const glm::vec3 p1, const glm::vec3 p2, const glm::vec3 p3); 
 
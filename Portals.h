@@ -0,0 +1,118 @@
+#ifndef PORTALS_H
+#define PORTALS_H
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Frustum.h"
+#include "Level.h"
+#include "Plane.h"
+
+/*
+ * Runtime cell and portal visibility. Starting in the camera's cell, every
+ * portal that survives the current frustum narrows it to the clipped portal
+ * opening and the walk continues into the neighbouring cell. Walls are only
+ * reported when their cell is reached and they overlap the narrowed frustum.
+ */
+class PortalGraph {
+public:
+    struct Portal {
+        std::vector<glm::vec3> polygon;
+        Plane plane;
+        int front;
+        int back;
+    };
+
+    struct Cell {
+        AABB bounds;
+        std::vector<int> walls;
+        std::vector<int> portals;
+    };
+
+    PortalGraph() {}
+
+    explicit PortalGraph(const LevelDesc& level) : level(level) {
+        for(auto& w : level.walls) {
+            wallPolygons.push_back(quadPoints(w.p1, w.p2, w.p3));
+        }
+        for(auto& c : level.cells) {
+            cells.push_back(Cell{ c.bounds, c.walls, std::vector<int>() });
+        }
+        for(size_t i = 0; i < level.portals.size(); i++) {
+            auto& p = level.portals[i];
+            portals.push_back(Portal{ quadPoints(p.p1, p.p2, p.p3), Plane(p.p1, p.p2, p.p3), p.front, p.back });
+            cells[p.front].portals.push_back((int)i);
+            cells[p.back].portals.push_back((int)i);
+        }
+        wallVisible.resize(wallPolygons.size());
+        cellVisible.resize(cells.size());
+        onPath.resize(cells.size());
+    }
+
+    // recomputes visibleWalls() for this frame
+    void update(const glm::vec3& eye, const glm::mat4& viewProjection) {
+        std::fill(wallVisible.begin(), wallVisible.end(), false);
+        std::fill(cellVisible.begin(), cellVisible.end(), false);
+        visible.clear();
+
+        int start = level.cellAt(eye);
+        if(start < 0) return;
+        visit(start, eye, Frustum(viewProjection), 0);
+    }
+
+    const std::vector<int>& visibleWalls() const { return visible; }
+
+    bool isCellVisible(int cell) const { return cell >= 0 && cellVisible[cell]; }
+
+    int cellAt(const glm::vec3& point) const { return level.cellAt(point); }
+
+private:
+    LevelDesc level;
+    std::vector<std::vector<glm::vec3>> wallPolygons;
+    std::vector<Cell> cells;
+    std::vector<Portal> portals;
+
+    std::vector<bool> wallVisible;
+    std::vector<bool> cellVisible;
+    std::vector<bool> onPath;
+    std::vector<int> visible;
+
+    const int maxDepth = 16;
+    // eye this close to a portal plane is standing in the opening
+    const float portalEpsilon = 0.15f;
+
+    void visit(int cell, const glm::vec3& eye, const Frustum& frustum, int depth) {
+        cellVisible[cell] = true;
+        onPath[cell] = true;
+
+        for(int w : cells[cell].walls) {
+            if(wallVisible[w]) continue;
+            if(!frustum.intersects(wallPolygons[w])) continue;
+            wallVisible[w] = true;
+            visible.push_back(w);
+        }
+
+        if(depth < maxDepth) {
+            for(int p : cells[cell].portals) {
+                const Portal& portal = portals[p];
+                int next = portal.front == cell ? portal.back : portal.front;
+                if(onPath[next]) continue;
+
+                // only look out through a portal from this cell's side of it
+                double dist = portal.plane.signedDistanceTo(eye);
+                if(portal.front == cell ? dist < -portalEpsilon : dist > portalEpsilon) continue;
+
+                if(glm::abs(dist) <= portalEpsilon) {
+                    visit(next, eye, frustum, depth + 1);
+                    continue;
+                }
+
+                auto clipped = frustum.clip(portal.polygon);
+                if(clipped.empty()) continue;
+                visit(next, eye, Frustum::throughPolygon(eye, clipped), depth + 1);
+            }
+        }
+        onPath[cell] = false;
+    }
+};
+#endif
@@ -0,0 +1,171 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "GLExtensions.h"
+
+/*
+ * On-disk cache of linked programs (glGetProgramBinary). Entries are keyed by
+ * a hash of every stage's source together with the driver's vendor, renderer
+ * and version strings, so editing a shader or updating the driver simply
+ * misses. Drivers may still refuse a blob, in which case the caller compiles
+ * from source and the entry is overwritten.
+ *
+ * File layout: "PBIN", uint32 binary format, uint32 length, blob.
+ */
+class ProgramCache {
+public:
+    std::string directory = "./shader_cache/";
+    int hits = 0;
+    int misses = 0;
+    // time spent in Shader constructors, cached or not; with async builds only the submission
+    double milliseconds = 0.0;
+    // from the first build starting to the latest one found linked, compile and link included
+    double readyMilliseconds = 0.0;
+
+    // adds its lifetime to milliseconds
+    class Timer {
+    public:
+        explicit Timer(ProgramCache& cache) : cache(cache), start(std::chrono::steady_clock::now()) {}
+        ~Timer() {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            cache.milliseconds += elapsed.count();
+        }
+    private:
+        ProgramCache& cache;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // a program's first build, not reloads
+    void buildStarted() {
+        if(!started) firstBuild = std::chrono::steady_clock::now();
+        started = true;
+    }
+
+    void buildFinished() {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - firstBuild;
+        readyMilliseconds = elapsed.count();
+    }
+
+    bool isEnabled() const {
+        return glExtensions().programBinary;
+    }
+
+    uint64_t key(const std::vector<const std::string*>& sources) const {
+        uint64_t hash = 14695981039346656037ull;
+        for(const std::string* source : sources) {
+            hash = fnv1a(hash, source->data(), source->size());
+            // stage separator, so moving text between stages changes the key
+            hash = fnv1a(hash, "\0", 1);
+        }
+        for(GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            const char* value = (const char*)glGetString(name);
+            if(value) hash = fnv1a(hash, value, strlen(value));
+        }
+        return hash;
+    }
+
+    // true when program now holds a successfully linked cached binary
+    bool load(GLuint program, uint64_t key) {
+        if(!isEnabled()) return false;
+        FILE* file = fopen(pathFor(key).c_str(), "rb");
+        if(!file) {
+            misses++;
+            return false;
+        }
+
+        char magic[4];
+        uint32_t header[2];
+        std::vector<char> blob;
+        bool ok = fread(magic, 1, 4, file) == 4
+               && memcmp(magic, MAGIC, 4) == 0
+               && fread(header, sizeof(uint32_t), 2, file) == 2;
+        if(ok) {
+            blob.resize(header[1]);
+            ok = fread(blob.data(), 1, blob.size(), file) == blob.size();
+        }
+        fclose(file);
+
+        if(ok) {
+            glExtensions().programBinaryLoad(program, header[0], blob.data(), (GLsizei)blob.size());
+            GLint success = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            ok = success;
+        }
+        if(ok) hits++;
+        else misses++;
+        return ok;
+    }
+
+    // call before glLinkProgram so the driver keeps a retrievable binary
+    void prepare(GLuint program) const {
+        if(!isEnabled()) return;
+        glExtensions().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // written to a temporary name first, so a full disk or a second instance never leaves a half file behind
+    void store(GLuint program, uint64_t key) const {
+        if(!isEnabled()) return;
+        GLint success = 0, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(!success || length <= 0) return;
+
+        std::vector<char> blob(length);
+        GLenum format = 0;
+        glExtensions().getProgramBinary(program, length, &length, &format, blob.data());
+
+        mkdir(directory.c_str(), 0755);
+        std::string path = pathFor(key);
+        std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if(!file) {
+            std::cout << "ERROR::PROGRAM_CACHE::CANNOT_WRITE " << path << std::endl;
+            return;
+        }
+        uint32_t header[2] = { format, (uint32_t)length };
+        bool ok = fwrite(MAGIC, 1, 4, file) == 4
+               && fwrite(header, sizeof(uint32_t), 2, file) == 2
+               && fwrite(blob.data(), 1, length, file) == (size_t)length;
+        ok = fclose(file) == 0 && ok;
+        if(ok) ok = rename(temporary.c_str(), path.c_str()) == 0;
+        if(!ok) {
+            std::cout << "ERROR::PROGRAM_CACHE::CANNOT_WRITE " << path << std::endl;
+            remove(temporary.c_str());
+        }
+    }
+
+private:
+    static constexpr const char* MAGIC = "PBIN";
+    bool started = false;
+    std::chrono::steady_clock::time_point firstBuild;
+
+    static uint64_t fnv1a(uint64_t hash, const char* data, size_t size) {
+        for(size_t i = 0; i < size; i++) {
+            hash ^= (uint8_t)data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string pathFor(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return directory + name;
+    }
+};
+
+inline ProgramCache& programCache() {
+    static ProgramCache cache;
+    return cache;
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef SHADER_FEATURES_H
+#define SHADER_FEATURES_H
+
+#include <cstdint>
+
+// static features compiled in with #define instead of branching at runtime;
+// no GL here so shader_reflect can validate every permutation
+enum ShaderFeature : uint32_t {
+    FEATURE_PHONG    = 1u << 0,
+    FEATURE_TEXTURED = 1u << 1,
+    // with TEXTURED, samples a texture array by the vertices' layer
+    FEATURE_TEXTURE_ARRAY = 1u << 2,
+    // samples a virtual texture (VirtualTextures.h) instead
+    FEATURE_VIRTUAL_TEXTURE = 1u << 3,
+};
+
+const char* const SHADER_FEATURE_NAMES[] = { "PHONG", "TEXTURED", "TEXTURE_ARRAY", "VIRTUAL_TEXTURE" };
+const int SHADER_FEATURE_COUNT = sizeof(SHADER_FEATURE_NAMES) / sizeof(SHADER_FEATURE_NAMES[0]);
+#endif
@@ -0,0 +1,76 @@
+#ifndef SHADER_SOURCES_H
+#define SHADER_SOURCES_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+struct EmbeddedShader {
+    const char* path;       // relative to the repo root, no leading "./"
+    const char* source;
+    size_t size;
+    const char* const* defines; // names tested by #ifdef etc., nullptr terminated
+};
+
+// generated by embed_shaders (see Makefile); without it everything is read from disk
+#if __has_include("shaders_embedded.h")
+#include "shaders_embedded.h"
+#define HAVE_EMBEDDED_SHADERS 1
+#endif
+
+/*
+ * Where shader text comes from. Normally the sources compiled into the
+ * binary; setting SHADER_OVERRIDE_DIR makes every lookup go to that
+ * directory instead (e.g. the checkout, to edit shaders without rebuilding).
+ */
+class ShaderSources {
+public:
+    static const char* overrideDirectory() {
+        static const char* directory = getenv("SHADER_OVERRIDE_DIR");
+        return directory && *directory ? directory : nullptr;
+    }
+
+    static std::string normalize(const char* path) {
+        while(strncmp(path, "./", 2) == 0) path += 2;
+        return path;
+    }
+
+    // embedded copy of path, nullptr when there is none or an override is set
+    static const EmbeddedShader* find(const char* path) {
+#ifdef HAVE_EMBEDDED_SHADERS
+        if(overrideDirectory()) return nullptr;
+        std::string name = normalize(path);
+        for(const EmbeddedShader& shader : EMBEDDED_SHADERS) {
+            if(name == shader.path) return &shader;
+        }
+#endif
+        return nullptr;
+    }
+
+    // edits on disk are picked up, needed for hot reload
+    static bool readsFromDisk() {
+#ifdef HAVE_EMBEDDED_SHADERS
+        return overrideDirectory() != nullptr;
+#else
+        return true;
+#endif
+    }
+
+    // file to open when the source isn't embedded
+    static std::string diskPath(const char* path) {
+        if(!overrideDirectory()) return path;
+        return std::string(overrideDirectory()) + "/" + normalize(path);
+    }
+
+    // false only when the embedded metadata proves path never tests name
+    static bool mayUseDefine(const char* path, const char* name) {
+        const EmbeddedShader* shader = find(path);
+        if(!shader) return true;
+        for(const char* const* define = shader->defines; *define; define++) {
+            if(strcmp(*define, name) == 0) return true;
+        }
+        return false;
+    }
+};
+#endif
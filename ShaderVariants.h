@@ -0,0 +1,57 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ShaderFeatures.h"
+#include "shader.h"
+
+/*
+ * Every combination of features used with one vertex/fragment pair becomes
+ * its own program, built on first request and kept by feature mask. The
+ * mask is also part of the preprocessed source, so each permutation gets its
+ * own program cache entry.
+ */
+class ShaderVariants {
+public:
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, Shader* fallback = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), fallback(fallback) {
+        // features neither stage tests would only produce duplicate programs
+        for(int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+            if(!ShaderSources::mayUseDefine(vertexPath, SHADER_FEATURE_NAMES[i]) &&
+               !ShaderSources::mayUseDefine(fragmentPath, SHADER_FEATURE_NAMES[i])) {
+                relevant &= ~(1u << i);
+            }
+        }
+    }
+
+    // starts compiling a permutation ahead of its first use
+    void prepare(uint32_t features) {
+        get(features);
+    }
+
+    Shader& get(uint32_t features) {
+        features &= relevant;
+        auto it = programs.find(features);
+        if(it != programs.end()) return *it->second;
+
+        std::vector<std::string> defines;
+        for(int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+            if(features & (1u << i)) defines.push_back(SHADER_FEATURE_NAMES[i]);
+        }
+        Shader* shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), fallback, defines);
+        programs[features].reset(shader);
+        return *shader;
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    Shader* fallback;
+    uint32_t relevant = ~0u;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> programs;
+};
+#endif
@@ -0,0 +1,123 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <sys/stat.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include "shader.h"
+#include "ShaderSources.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Hot reload for development. Watches the shader directory (inotify on
+ * Linux, modification times every pollInterval elsewhere) and reloads only
+ * the programs whose sources or includes changed; see Shader::reload for
+ * how the swap happens. Only useful when sources come from disk, i.e. with
+ * SHADER_OVERRIDE_DIR set or without embedded shaders.
+ */
+class ShaderWatcher {
+public:
+    std::chrono::milliseconds pollInterval{ 250 };
+
+    ~ShaderWatcher() {
+#ifdef __linux__
+        if(fd >= 0) close(fd);
+#endif
+    }
+
+    // directory as the shaders name it, e.g. "shaders"
+    bool start(const std::string& directory) {
+        this->directory = ShaderSources::normalize(directory.c_str());
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd >= 0) {
+            // editors that save by renaming show up as IN_MOVED_TO
+            std::string path = ShaderSources::diskPath(this->directory.c_str());
+            if(inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0) return true;
+            std::cout << "ERROR::SHADER_WATCHER::CANNOT_WATCH " << path << std::endl;
+            close(fd);
+            fd = -1;
+        }
+#endif
+        // fall back to polling modification times
+        polling = true;
+        lastPoll = std::chrono::steady_clock::now();
+        for(Shader* shader : Shader::all()) {
+            for(const std::string& file : shader->sourceFiles()) mtimes[file] = modificationTime(file);
+        }
+        return true;
+    }
+
+    // once per frame, never blocks
+    void update() {
+        std::set<std::string> changed;
+#ifdef __linux__
+        if(fd >= 0) readEvents(changed);
+#endif
+        if(polling) pollFiles(changed);
+        if(changed.empty()) return;
+
+        for(Shader* shader : Shader::all()) {
+            for(const std::string& file : changed) {
+                if(shader->sourceFiles().count(file)) {
+                    shader->reload();
+                    break;
+                }
+            }
+        }
+    }
+
+private:
+    std::string directory;
+    int fd = -1;
+    bool polling = false;
+    std::chrono::steady_clock::time_point lastPoll;
+    std::map<std::string, long long> mtimes;
+
+#ifdef __linux__
+    void readEvents(std::set<std::string>& changed) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for(char* at = buffer; at < buffer + length; ) {
+                inotify_event* event = (inotify_event*)at;
+                if(event->len) changed.insert(directory + "/" + event->name);
+                at += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+#endif
+
+    void pollFiles(std::set<std::string>& changed) {
+        auto now = std::chrono::steady_clock::now();
+        if(now - lastPoll < pollInterval) return;
+        lastPoll = now;
+
+        for(Shader* shader : Shader::all()) {
+            for(const std::string& file : shader->sourceFiles()) {
+                long long mtime = modificationTime(file);
+                auto known = mtimes.find(file);
+                if(known != mtimes.end() && known->second != mtime) changed.insert(file);
+                mtimes[file] = mtime;
+            }
+        }
+    }
+
+    static long long modificationTime(const std::string& file) {
+        struct stat info;
+        if(stat(ShaderSources::diskPath(file.c_str()).c_str(), &info) != 0) return 0;
+#ifdef __APPLE__
+        return (long long)info.st_mtimespec.tv_sec * 1000000000ll + info.st_mtimespec.tv_nsec;
+#else
+        return (long long)info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+#endif
+    }
+};
+#endif
@@ -0,0 +1,115 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "TextureImage.h"
+
+/*
+ * On-disk cache of decoded textures with their mip chains, keyed by a hash of
+ * the source file's bytes. A hit maps the file and hands the mapping to the
+ * upload as is, so a warm start neither decodes nor copies pixels on the CPU
+ * beyond the copy into the unpack buffer. Safe to use from worker threads.
+ *
+ * File layout: "TXCH", uint32 version, width, height, levels, channels,
+ * then TextureImage's level-after-level pixels.
+ */
+class TextureCache {
+public:
+    std::string directory = "./texture_cache/";
+    std::atomic<int> hits{0};
+    std::atomic<int> misses{0};
+
+    static uint64_t key(const char* data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for(size_t i = 0; i < size; i++) {
+            hash ^= (uint8_t)data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // nullptr on a miss or a file that doesn't match its header
+    std::unique_ptr<TextureImage> load(uint64_t key) {
+        int fd = open(pathFor(key).c_str(), O_RDONLY);
+        if(fd < 0) {
+            misses++;
+            return nullptr;
+        }
+        struct stat info;
+        void* mapping = MAP_FAILED;
+        if(fstat(fd, &info) == 0 && (size_t)info.st_size >= HEADER_SIZE) {
+            mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            misses++;
+            return nullptr;
+        }
+
+        uint32_t header[5];
+        memcpy(header, (const char*)mapping + 4, sizeof(header));
+        bool ok = memcmp(mapping, MAGIC, 4) == 0
+               && header[0] == VERSION
+               && header[4] == (uint32_t)TextureImage::channels(FORMAT_RGBA8)
+               && header[3] == (uint32_t)TextureImage::levelCount(header[1], header[2])
+               && (size_t)info.st_size == HEADER_SIZE + TextureImage::chainSize(FORMAT_RGBA8, header[1], header[2]);
+        if(!ok) {
+            munmap(mapping, info.st_size);
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        return TextureImage::fromMapping(mapping, info.st_size, HEADER_SIZE, FORMAT_RGBA8, header[1], header[2]);
+    }
+
+    // RGBA8 chains only (what uncompressed textures upload as), written to a temporary name first so readers never map half a file
+    void store(uint64_t key, const TextureImage& image) const {
+        if(image.format != FORMAT_RGBA8) return;
+        mkdir(directory.c_str(), 0755);
+        std::string path = pathFor(key);
+        std::string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if(!file) {
+            std::cout << "ERROR::TEXTURE_CACHE::CANNOT_WRITE " << path << std::endl;
+            return;
+        }
+        uint32_t header[5] = { VERSION, (uint32_t)image.width, (uint32_t)image.height,
+                               (uint32_t)image.levels, (uint32_t)TextureImage::channels(FORMAT_RGBA8) };
+        bool ok = fwrite(MAGIC, 1, 4, file) == 4
+               && fwrite(header, sizeof(uint32_t), 5, file) == 5
+               && fwrite(image.data, 1, image.size, file) == image.size;
+        ok = fclose(file) == 0 && ok;
+        if(ok) ok = rename(temporary.c_str(), path.c_str()) == 0;
+        if(!ok) {
+            std::cout << "ERROR::TEXTURE_CACHE::CANNOT_WRITE " << path << std::endl;
+            remove(temporary.c_str());
+        }
+    }
+
+private:
+    static constexpr const char* MAGIC = "TXCH";
+    static const uint32_t VERSION = 3;
+    static const size_t HEADER_SIZE = 4 + 5 * sizeof(uint32_t);
+
+    std::string pathFor(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)key);
+        return directory + name;
+    }
+};
+
+inline TextureCache& textureCache() {
+    static TextureCache cache;
+    return cache;
+}
+#endif
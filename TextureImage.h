@@ -0,0 +1,150 @@
+#ifndef TEXTURE_IMAGE_H
+#define TEXTURE_IMAGE_H
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+enum TextureFormat {
+    FORMAT_RGB8,
+    FORMAT_RGBA8,
+    // 4x4 blocks, 8 bytes each, RGB
+    FORMAT_BC1,
+    // 4x4 blocks, 16 bytes each, BC1 color plus interpolated alpha
+    FORMAT_BC3,
+};
+
+/*
+ * A whole mip chain stored level after level, largest first, with rows (of
+ * texels, or of 4x4 blocks for compressed formats) tightly packed. The bytes
+ * are either owned or point straight into a memory-mapped cache file (see
+ * TextureCache.h). No GL here, so worker threads and offline tools can build
+ * and read these.
+ */
+class TextureImage {
+public:
+    TextureFormat format = FORMAT_RGB8;
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    TextureImage() {}
+    TextureImage(const TextureImage&) = delete;
+    TextureImage& operator=(const TextureImage&) = delete;
+
+    ~TextureImage() {
+        if(mapping) munmap(mapping, mappingSize);
+    }
+
+    static int levelCount(int width, int height) {
+        int count = 1;
+        while(width > 1 || height > 1) {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            count++;
+        }
+        return count;
+    }
+
+    static bool isCompressed(TextureFormat format) {
+        return format == FORMAT_BC1 || format == FORMAT_BC3;
+    }
+
+    // texels per side of a block, 1 when uncompressed
+    static int blockSize(TextureFormat format) {
+        return isCompressed(format) ? 4 : 1;
+    }
+
+    // bytes per block, or per texel when uncompressed
+    static int blockBytes(TextureFormat format) {
+        switch(format) {
+            case FORMAT_RGB8:  return 3;
+            case FORMAT_RGBA8: return 4;
+            case FORMAT_BC1:   return 8;
+            case FORMAT_BC3:   return 16;
+        }
+        return 0;
+    }
+
+    // channels once decoded
+    static int channels(TextureFormat format) {
+        return format == FORMAT_RGB8 || format == FORMAT_BC1 ? 3 : 4;
+    }
+
+    static size_t levelSize(TextureFormat format, int width, int height) {
+        int block = blockSize(format);
+        return (size_t)((width + block - 1) / block) * ((height + block - 1) / block) * blockBytes(format);
+    }
+
+    // from firstLevel down to 1x1
+    static size_t chainSize(TextureFormat format, int width, int height, int firstLevel = 0) {
+        size_t total = 0;
+        for(int level = firstLevel; level < levelCount(width, height); level++) {
+            total += levelSize(format, std::max(1, width >> level), std::max(1, height >> level));
+        }
+        return total;
+    }
+
+    int levelWidth(int level) const { return std::max(1, width >> level); }
+    int levelHeight(int level) const { return std::max(1, height >> level); }
+
+    size_t levelSize(int level) const {
+        return levelSize(format, levelWidth(level), levelHeight(level));
+    }
+
+    // bytes in one row of texels, or one row of blocks
+    size_t rowPitch(int level) const {
+        int block = blockSize(format);
+        return (size_t)((levelWidth(level) + block - 1) / block) * blockBytes(format);
+    }
+
+    size_t levelOffset(int level) const {
+        size_t offset = 0;
+        for(int i = 0; i < level; i++) offset += levelSize(i);
+        return offset;
+    }
+
+    const unsigned char* level(int level) const {
+        return data + levelOffset(level);
+    }
+
+    // takes over a mapping whose chain starts at offset
+    static std::unique_ptr<TextureImage> fromMapping(void* mapping, size_t mappingSize, size_t offset,
+                                                     TextureFormat format, int width, int height) {
+        std::unique_ptr<TextureImage> image(new TextureImage());
+        image->format = format;
+        image->width = width;
+        image->height = height;
+        image->levels = levelCount(width, height);
+        image->mapping = mapping;
+        image->mappingSize = mappingSize;
+        image->data = (const unsigned char*)mapping + offset;
+        image->size = chainSize(format, width, height);
+        return image;
+    }
+
+    // takes over bytes already laid out as above
+    static std::unique_ptr<TextureImage> fromBytes(std::vector<unsigned char>&& bytes, TextureFormat format,
+                                                   int width, int height, int levels) {
+        std::unique_ptr<TextureImage> image(new TextureImage());
+        image->format = format;
+        image->width = width;
+        image->height = height;
+        image->levels = levels;
+        image->owned = std::move(bytes);
+        image->data = image->owned.data();
+        image->size = image->owned.size();
+        return image;
+    }
+
+private:
+    std::vector<unsigned char> owned;
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+};
+#endif
@@ -0,0 +1,742 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BlockCompression.h"
+#include "GLExtensions.h"
+#include "ImageDecoder.h"
+#include "KTX2.h"
+#include "MipGenerator.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+// index into TextureManager, 0 means no texture
+struct TextureHandle {
+    uint32_t index = 0;
+
+    explicit operator bool() const { return index != 0; }
+    bool operator==(const TextureHandle& other) const { return index == other.index; }
+    bool operator!=(const TextureHandle& other) const { return index != other.index; }
+};
+
+/*
+ * Owns every GL texture object. A texture is looked up by path first and then
+ * by a hash of the file's bytes, so the same image is decoded and uploaded
+ * once however many paths or objects refer to it. Handles are refcounted by
+ * hand (load/retain/release) rather than by destructors, since handles held
+ * by globals would otherwise outlive the GL context.
+ *
+ * When a cooked .ktx2 (texture_tool cook) sits next to the requested image it
+ * is loaded instead, and its BC1/BC3 levels upload as they are, or are
+ * decoded on the CPU if the GPU lacks S3TC.
+ *
+ * Loading is asynchronous. A newly requested file is read and hashed on the
+ * caller's thread, to find it by contents; the reads that streaming triggers
+ * later happen on the pool. There the hash is looked up in the TextureCache, and
+ * on a miss the file is decoded (ImageDecoder.h), mipmapped (MipGenerator.h)
+ * and stored there. update() then streams every level through an orphaned
+ * pixel unpack buffer a few rows at a time, never more than uploadBudget bytes
+ * per frame. After the last rows a fence is inserted, and the texture is only
+ * bound once that fence has signalled. Until then bind() uses a grey checker
+ * placeholder.
+ *
+ * loadArray() builds a GL_TEXTURE_2D_ARRAY instead (see MaterialPacker.h):
+ * each path becomes one layer and goes through the same pipeline, converted
+ * on the worker to the array's size and format if it doesn't match. The array
+ * becomes resident once its last layer has been uploaded.
+ *
+ * Storage is immutable (glTexStorage2D/3D) where the driver has it, with
+ * sized internal formats, and allocated with glTexImage otherwise. Pixels
+ * reach GL in the layout the texture stores: uncompressed images are decoded
+ * to RGBA8 rather than RGB8, which most drivers would expand texel by texel,
+ * and rows are tightly packed with an unpack alignment of 1. Sampling state
+ * lives in sampler objects shared by every texture, not in the textures.
+ *
+ * Mips are streamed (see TextureStreamer.h). Every texture has a target level,
+ * the finest mip it should have on the GPU. Levels upload coarsest first and
+ * only down to the target. Immutable storage can't grow or free single
+ * levels, so a texture whose target changes gets a new GL texture with the
+ * target as its level 0. Dropping levels copies the ones kept into it on the
+ * GPU (glCopyImageSubData) and swaps it in right away, so eviction never
+ * holds both. Streaming finer levels in fills it from the TextureCache or the
+ * cooked file again, which a warm cache makes cheap, while the old one stays
+ * bound, and it replaces the old one once its fence has signalled. Without
+ * copy support eviction reloads from the source the same way.
+ */
+class TextureManager {
+public:
+    enum State { DECODING, UPLOADING, FENCED, RESIDENT, FAILED };
+
+    struct Texture {
+        // level 0 is mip residentLevel of the chain
+        GLuint id = 0;
+        // the next id while it is being filled, level 0 is mip uploadLevel
+        GLuint pendingId = 0;
+        // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY from loadArray()
+        GLenum target = GL_TEXTURE_2D;
+        int width = 0;
+        int height = 0;
+        int layers = 1;
+        int levels = 0;
+        TextureFormat format = FORMAT_RGB8;
+        // bytes of GPU memory, resident mips only
+        size_t bytes = 0;
+        int refs = 0;
+        std::string path;
+        uint64_t hash = 0;
+
+        State state = DECODING;
+        // bumped when the slot is reused, stale decode results are dropped
+        uint32_t generation = 0;
+        // layers not uploaded yet
+        int pendingLayers = 1;
+        GLsync fence = nullptr;
+
+        // finest mip that can be sampled
+        int residentLevel = 0;
+        // finest mip wanted, clamped to the chain once its size is known
+        int targetLevel = 0;
+        // finest mip of the upload in flight, -1 when there is none
+        int uploadLevel = -1;
+        // what each layer is read from again to change levels, empty if it couldn't be read
+        std::vector<std::string> sources;
+    };
+
+    // bytes copied into the unpack buffer per update()
+    size_t uploadBudget = 4 * 1024 * 1024;
+
+    // the cache must outlive the workers that use it, statics die in reverse order
+    TextureManager() {
+        textureCache();
+    }
+
+    // look for a cooked .ktx2 next to each requested image
+    bool preferCooked = true;
+
+    // sRGB internal formats, so sampling returns linear values; off while
+    // lighting is done on the gamma-encoded values and the framebuffer isn't sRGB
+    bool srgb = false;
+
+    // for the startup report
+    int requests = 0;
+    int decodes = 0;
+    int cached = 0;
+    int cooked = 0;
+    // mip streaming, in textures
+    int streamedIn = 0;
+    int evicted = 0;
+
+    // +1 reference, an empty handle if the file can't be read
+    TextureHandle load(const std::string& path) {
+        requests++;
+        auto byPath = paths.find(path);
+        if(byPath != paths.end()) return retain(byPath->second);
+
+        std::string source;
+        std::shared_ptr<std::vector<char>> bytes = readSource(path, source);
+        if(!bytes) return TextureHandle();
+
+        uint64_t hash = TextureCache::key(bytes->data(), bytes->size());
+        auto byHash = hashes.find(hash);
+        if(byHash != hashes.end()) {
+            paths[path] = byHash->second;
+            return retain(byHash->second);
+        }
+
+        TextureHandle handle = allocate();
+        Texture& texture = textures[handle.index];
+        texture.path = source;
+        texture.hash = hash;
+        texture.sources.push_back(path);
+        paths[path] = handle;
+        hashes[hash] = handle;
+        decode(handle.index, texture.generation, 0, hash, bytes);
+        return retain(handle);
+    }
+
+    // +1 reference to a texture array with a layer per path, each fitted to
+    // width x height; BC1 when the GPU has S3TC, RGBA8 otherwise. A layer that can't be read is left without contents.
+    TextureHandle loadArray(const std::vector<std::string>& layerPaths, int width, int height) {
+        if(layerPaths.empty()) return TextureHandle();
+        TextureHandle handle = allocate();
+        Texture& texture = textures[handle.index];
+        texture.target = GL_TEXTURE_2D_ARRAY;
+        texture.width = width;
+        texture.height = height;
+        texture.layers = (int)layerPaths.size();
+        texture.levels = TextureImage::levelCount(width, height);
+        texture.format = glExtensions().textureCompressionS3TC ? FORMAT_BC1 : FORMAT_RGBA8;
+        texture.pendingLayers = texture.layers;
+        for(const std::string& path : layerPaths) {
+            if(!texture.path.empty()) texture.path += ", ";
+            texture.path += path;
+        }
+
+        for(int layer = 0; layer < texture.layers; layer++) {
+            requests++;
+            std::string source;
+            std::shared_ptr<std::vector<char>> bytes = readSource(layerPaths[layer], source);
+            texture.sources.push_back(bytes ? layerPaths[layer] : "");
+            if(!bytes) {
+                layerDone(texture);
+                continue;
+            }
+            decode(handle.index, texture.generation, layer, TextureCache::key(bytes->data(), bytes->size()), bytes);
+        }
+        return retain(handle);
+    }
+
+    TextureHandle retain(TextureHandle handle) {
+        if(handle) textures[handle.index].refs++;
+        return handle;
+    }
+
+    // deletes the GL texture with the last reference, also mid-load
+    void release(TextureHandle handle) {
+        if(!handle) return;
+        Texture& texture = textures[handle.index];
+        if(--texture.refs > 0) return;
+
+        if(texture.id) glDeleteTextures(1, &texture.id);
+        if(texture.pendingId) glDeleteTextures(1, &texture.pendingId);
+        if(texture.fence) glDeleteSync(texture.fence);
+        for(auto it = paths.begin(); it != paths.end();) {
+            if(it->second == handle) it = paths.erase(it);
+            else ++it;
+        }
+        if(texture.target == GL_TEXTURE_2D) hashes.erase(texture.hash);
+        uint32_t generation = texture.generation + 1;
+        texture = Texture();
+        texture.generation = generation;
+        freeSlots.push_back(handle.index);
+    }
+
+    const Texture& get(TextureHandle handle) const {
+        return textures[handle.index];
+    }
+
+    bool isResident(TextureHandle handle) const {
+        return handle && textures[handle.index].state == RESIDENT;
+    }
+
+    // an empty handle binds nothing, a loading one the placeholder
+    void bind(TextureHandle handle, int unit = 0) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        if(!handle) {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return;
+        }
+        const Texture& texture = textures[handle.index];
+        bool resident = texture.state == RESIDENT;
+        glBindTexture(texture.target, resident ? texture.id : placeholderTexture(texture.target));
+        glBindSampler(unit, sampler(resident ? SAMPLER_TRILINEAR_REPEAT : SAMPLER_NEAREST_REPEAT));
+    }
+
+    // finest mip the texture should keep on the GPU, applied by update()
+    void setTargetLevel(TextureHandle handle, int level) {
+        if(handle) textures[handle.index].targetLevel = std::max(0, level);
+    }
+
+    // handles run from 1 to slotCount() - 1, released ones have no references
+    uint32_t slotCount() const {
+        return (uint32_t)textures.size();
+    }
+
+    // once per frame on the render thread
+    void update() {
+        collectDecoded();
+        upload();
+        checkFences();
+        stream();
+    }
+
+    // textures neither resident nor failed yet
+    int pendingCount() const {
+        int pending = 0;
+        for(size_t i = 1; i < textures.size(); i++) {
+            if(textures[i].refs > 0 && textures[i].state != RESIDENT && textures[i].state != FAILED) pending++;
+        }
+        return pending;
+    }
+
+    // array layers count one each
+    int uniqueCount() const {
+        int count = (int)hashes.size();
+        for(const Texture& t : textures) {
+            if(t.refs > 0 && t.target == GL_TEXTURE_2D_ARRAY) count += t.layers;
+        }
+        return count;
+    }
+
+    size_t totalBytes() const {
+        size_t total = 0;
+        for(const Texture& t : textures) {
+            if(t.state == RESIDENT) total += t.bytes;
+        }
+        return total;
+    }
+
+private:
+    struct Decoded {
+        uint32_t index;
+        uint32_t generation;
+        int layer;
+        std::unique_ptr<TextureImage> image;
+        // 0 decoded, 1 texture cache, 2 cooked file
+        int origin;
+        std::string error;
+    };
+
+    // slot 0 backs the empty handle
+    std::vector<Texture> textures = std::vector<Texture>(1);
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::string, TextureHandle> paths;
+    std::unordered_map<uint64_t, TextureHandle> hashes;
+
+    // one layer's pixels on their way to the GPU, dropped once every level is sent
+    struct Upload {
+        uint32_t index;
+        uint32_t generation;
+        int layer;
+        std::unique_ptr<TextureImage> image;
+        int level;
+        int rows;
+    };
+
+    // GL formats of a TextureFormat, sized for storage
+    struct GLFormat {
+        GLenum internalFormat;
+        // what glTexSubImage is handed, unused for compressed formats
+        GLenum format;
+        GLenum type;
+    };
+
+    enum Sampler { SAMPLER_TRILINEAR_REPEAT, SAMPLER_NEAREST_REPEAT, SAMPLER_COUNT };
+
+    // in the order decodes finished
+    std::deque<Upload> uploads;
+    GLuint unpackBuffer = 0;
+    GLuint placeholder = 0;
+    GLuint arrayPlaceholder = 0;
+    GLuint samplers[SAMPLER_COUNT] = {};
+
+    std::mutex decodedMutex;
+    std::vector<Decoded> decoded;
+    // declared last so workers are joined before the rest is torn down
+    std::unique_ptr<ThreadPool> pool;
+
+    TextureHandle allocate() {
+        TextureHandle handle;
+        if(!freeSlots.empty()) {
+            handle.index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            handle.index = (uint32_t)textures.size();
+            textures.emplace_back();
+        }
+        return handle;
+    }
+
+    // the cooked file if there is one, nullptr if neither can be read
+    std::shared_ptr<std::vector<char>> readSource(const std::string& path, std::string& source) const {
+        std::shared_ptr<std::vector<char>> bytes = readFile(path, preferCooked, source);
+        if(!bytes) std::cout << "ERROR::TEXTURE::FILE_NOT_SUCCESSFULLY_READ " << source << std::endl;
+        return bytes;
+    }
+
+    // readSource without the report, safe on the workers
+    static std::shared_ptr<std::vector<char>> readFile(const std::string& path, bool preferCooked, std::string& source) {
+        source = path;
+        if(preferCooked && std::ifstream(cookedPath(path))) source = cookedPath(path);
+
+        std::ifstream file(source, std::ios::binary);
+        std::shared_ptr<std::vector<char>> bytes = std::make_shared<std::vector<char>>(
+            (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(bytes->empty()) return nullptr;
+        return bytes;
+    }
+
+    // without bytes the worker reads path itself (and hashes it for the cache key) first
+    void decode(uint32_t index, uint32_t generation, int layer, uint64_t key, std::shared_ptr<std::vector<char>> bytes,
+                const std::string& path = "") {
+        if(!pool) pool.reset(new ThreadPool());
+        bool compressedUploads = glExtensions().textureCompressionS3TC;
+        // array layers all have to match the array
+        const Texture& texture = textures[index];
+        bool fit = texture.target == GL_TEXTURE_2D_ARRAY;
+        TextureFormat format = texture.format;
+        int width = texture.width, height = texture.height;
+        bool cookedFirst = preferCooked;
+        pool->submit([this, index, generation, layer, key, bytes, path, cookedFirst, compressedUploads, fit, format,
+                      width, height]() mutable {
+            Decoded result{ index, generation, layer, nullptr, 2, "" };
+            if(!bytes) {
+                std::string source;
+                bytes = readFile(path, cookedFirst, source);
+                if(!bytes) {
+                    result.error = "cannot read " + source;
+                    std::lock_guard<std::mutex> lock(decodedMutex);
+                    decoded.push_back(std::move(result));
+                    return;
+                }
+                key = TextureCache::key(bytes->data(), bytes->size());
+            }
+            if(KTX2::isKTX2(bytes->data(), bytes->size())) {
+                result.image = KTX2::read(bytes->data(), bytes->size(), result.error);
+                if(result.image && !compressedUploads) result.image = decompressImage(*result.image, FORMAT_RGBA8);
+            } else {
+                result.origin = 1;
+                result.image = textureCache().load(key);
+            }
+            if(!result.image && result.error.empty()) {
+                result.origin = 0;
+                DecodedImage pixels;
+                if(decodeImage(bytes->data(), bytes->size(), TextureImage::channels(FORMAT_RGBA8), pixels, result.error)) {
+                    // one thread, the other workers are busy with the other textures
+                    MipGenerator generator;
+                    generator.threads = 1;
+                    result.image = generator.build(pixels.pixels.data(), pixels.width, pixels.height, FORMAT_RGBA8);
+                    textureCache().store(key, *result.image);
+                }
+            }
+            if(result.image && fit) result.image = fitImage(std::move(result.image), format, width, height);
+
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            decoded.push_back(std::move(result));
+        });
+    }
+
+    void collectDecoded() {
+        std::vector<Decoded> finished;
+        {
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            finished.swap(decoded);
+        }
+        for(Decoded& result : finished) {
+            Texture& texture = textures[result.index];
+            if(texture.generation != result.generation) continue;
+            if(!result.image) {
+                std::cout << "ERROR::TEXTURE::DECODE_FAILED " << texture.path;
+                if(texture.target == GL_TEXTURE_2D_ARRAY) std::cout << " layer " << result.layer;
+                std::cout << ": " << result.error << std::endl;
+                // a texture whose source went away keeps the mips it has, the reload is dropped
+                if(texture.state == RESIDENT) texture.sources.clear();
+                if(texture.target == GL_TEXTURE_2D_ARRAY || texture.state == RESIDENT) layerDone(texture);
+                else texture.state = FAILED;
+                continue;
+            }
+            if(result.origin == 0) decodes++;
+            else if(result.origin == 1) cached++;
+            else cooked++;
+            if(texture.target == GL_TEXTURE_2D) {
+                texture.width = result.image->width;
+                texture.height = result.image->height;
+                texture.levels = result.image->levels;
+                texture.format = result.image->format;
+            }
+            // coarsest first
+            if(texture.uploadLevel < 0) texture.uploadLevel = std::min(texture.targetLevel, texture.levels - 1);
+            if(texture.state != RESIDENT) texture.state = UPLOADING;
+            uploads.push_back(Upload{ result.index, result.generation, result.layer, std::move(result.image),
+                                      texture.levels - 1, 0 });
+        }
+    }
+
+    void upload() {
+        if(uploads.empty()) return;
+        if(!unpackBuffer) glGenBuffers(1, &unpackBuffer);
+
+        size_t budget = uploadBudget;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while(!uploads.empty() && budget > 0) {
+            Upload& pending = uploads.front();
+            Texture& texture = textures[pending.index];
+            if(texture.generation != pending.generation) {
+                uploads.pop_front();
+                continue;
+            }
+            if(reloadDropped(texture)) {
+                layerDone(texture);
+                uploads.pop_front();
+                continue;
+            }
+
+            const TextureImage& image = *pending.image;
+            bool compressed = TextureImage::isCompressed(image.format);
+            GLFormat format = glFormat(image.format);
+            if(!texture.pendingId) allocateStorage(texture);
+
+            // at least one row (of texels or blocks), so a row wider than the budget still moves
+            int level = pending.level;
+            int rowHeight = TextureImage::blockSize(image.format);
+            size_t rowBytes = image.rowPitch(level);
+            int rows = (int)std::max<size_t>(1, budget / rowBytes);
+            rows = std::min(rows * rowHeight, image.levelHeight(level) - pending.rows);
+            size_t size = rowBytes * ((rows + rowHeight - 1) / rowHeight);
+            budget -= std::min(budget, size);
+
+            // orphan the previous strip's storage so mapping never waits on the GPU
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if(!mapped) break;
+            memcpy(mapped, image.level(level) + rowBytes * (pending.rows / rowHeight), size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            // the new texture starts at uploadLevel
+            int glLevel = level - texture.uploadLevel;
+            glBindTexture(texture.target, texture.pendingId);
+            if(texture.target == GL_TEXTURE_2D_ARRAY && compressed) {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, glLevel, 0, pending.rows, pending.layer, image.levelWidth(level),
+                                          rows, 1, format.internalFormat, (GLsizei)size, (void*)0);
+            } else if(texture.target == GL_TEXTURE_2D_ARRAY) {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, glLevel, 0, pending.rows, pending.layer, image.levelWidth(level), rows, 1,
+                                format.format, format.type, (void*)0);
+            } else if(compressed) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, glLevel, 0, pending.rows, image.levelWidth(level), rows,
+                                          format.internalFormat, (GLsizei)size, (void*)0);
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, glLevel, 0, pending.rows, image.levelWidth(level), rows,
+                                format.format, format.type, (void*)0);
+            }
+            pending.rows += rows;
+            if(pending.rows == image.levelHeight(level)) {
+                pending.level--;
+                pending.rows = 0;
+            }
+
+            if(pending.level < texture.uploadLevel) {
+                layerDone(texture);
+                uploads.pop_front();
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // pendingId with every level from uploadLevel down (and every layer), allocated from no buffer
+    // rather than the unpack buffer
+    void allocateStorage(Texture& texture) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glGenTextures(1, &texture.pendingId);
+        GLenum target = texture.target;
+        glBindTexture(target, texture.pendingId);
+        int levels = texture.levels - texture.uploadLevel;
+        int width = std::max(1, texture.width >> texture.uploadLevel);
+        int height = std::max(1, texture.height >> texture.uploadLevel);
+        GLFormat format = glFormat(texture.format);
+        const GLExtensions& gl = glExtensions();
+        if(gl.textureStorage && target == GL_TEXTURE_2D_ARRAY) {
+            gl.texStorage3D(target, levels, format.internalFormat, width, height, texture.layers);
+        } else if(gl.textureStorage) {
+            gl.texStorage2D(target, levels, format.internalFormat, width, height);
+        } else {
+            glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+            for(int level = 0; level < levels; level++) {
+                int w = std::max(1, width >> level), h = std::max(1, height >> level);
+                GLsizei size = (GLsizei)(TextureImage::levelSize(texture.format, w, h) * texture.layers);
+                bool compressed = TextureImage::isCompressed(texture.format);
+                if(target == GL_TEXTURE_2D_ARRAY && compressed) {
+                    glCompressedTexImage3D(target, level, format.internalFormat, w, h, texture.layers, 0, size, nullptr);
+                } else if(target == GL_TEXTURE_2D_ARRAY) {
+                    glTexImage3D(target, level, format.internalFormat, w, h, texture.layers, 0, format.format,
+                                 format.type, nullptr);
+                } else if(compressed) {
+                    glCompressedTexImage2D(target, level, format.internalFormat, w, h, 0, size, nullptr);
+                } else {
+                    glTexImage2D(target, level, format.internalFormat, w, h, 0, format.format, format.type, nullptr);
+                }
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    }
+
+    // a resident texture whose source went away mid-reload keeps what it has
+    static bool reloadDropped(const Texture& texture) {
+        return texture.state == RESIDENT && texture.sources.empty();
+    }
+
+    // after the last layer the texture is fenced, or failed if none of it ever reached the GPU
+    void layerDone(Texture& texture) {
+        if(--texture.pendingLayers > 0) return;
+        if(!texture.pendingId || reloadDropped(texture)) {
+            if(texture.pendingId) glDeleteTextures(1, &texture.pendingId);
+            texture.pendingId = 0;
+            texture.uploadLevel = -1;
+            if(texture.state != RESIDENT) texture.state = FAILED;
+            return;
+        }
+        texture.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // a resident texture changing levels stays bound meanwhile
+        if(texture.state != RESIDENT) texture.state = FENCED;
+    }
+
+    // converts an array layer to the array's format and size, on a worker
+    static std::unique_ptr<TextureImage> fitImage(std::unique_ptr<TextureImage> image, TextureFormat format,
+                                                  int width, int height) {
+        if(image->format == format && image->width == width && image->height == height) return image;
+        if(TextureImage::isCompressed(image->format)) image = decompressImage(*image);
+        TextureFormat uncompressed = TextureImage::channels(format) == 4 ? FORMAT_RGBA8 : FORMAT_RGB8;
+        if(image->format != uncompressed || image->width != width || image->height != height) {
+            std::vector<unsigned char> pixels = MipGenerator::resize(image->level(0), image->width, image->height,
+                                                                     TextureImage::channels(image->format), width, height,
+                                                                     TextureImage::channels(uncompressed));
+            MipGenerator generator;
+            generator.threads = 1;
+            image = generator.build(pixels.data(), width, height, uncompressed);
+        }
+        if(TextureImage::isCompressed(format)) image = compressImage(*image, format);
+        return image;
+    }
+
+    // never waits, a fence still pending is looked at again next frame
+    void checkFences() {
+        for(size_t i = 1; i < textures.size(); i++) {
+            Texture& texture = textures[i];
+            if(!texture.fence) continue;
+            GLenum status = glClientWaitSync(texture.fence, 0, 0);
+            if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                glDeleteSync(texture.fence);
+                texture.fence = nullptr;
+                swapPending(texture);
+            }
+        }
+    }
+
+    // pendingId replaces id, its level 0 being uploadLevel
+    static void swapPending(Texture& texture) {
+        // draws already submitted keep the old texture alive until they finish
+        if(texture.id) glDeleteTextures(1, &texture.id);
+        texture.id = texture.pendingId;
+        texture.pendingId = 0;
+        texture.residentLevel = texture.uploadLevel;
+        texture.bytes = TextureImage::chainSize(texture.format, texture.width, texture.height,
+                                                texture.residentLevel) * texture.layers;
+        texture.uploadLevel = -1;
+        texture.state = RESIDENT;
+    }
+
+    // moves resident textures towards their target level, one reload in flight per texture
+    void stream() {
+        for(uint32_t i = 1; i < textures.size(); i++) {
+            Texture& texture = textures[i];
+            if(texture.refs == 0 || texture.state != RESIDENT || texture.uploadLevel >= 0) continue;
+            if(texture.sources.empty()) continue;
+            int target = std::min(texture.targetLevel, texture.levels - 1);
+            if(target == texture.residentLevel) continue;
+            if(target > texture.residentLevel) {
+                evicted++;
+                if(shrink(texture, target)) continue;
+            } else {
+                streamedIn++;
+            }
+            reload(i, texture, target);
+        }
+    }
+
+    // keeps the levels from level down by copying them into a smaller texture on the GPU, which
+    // replaces the old one at once; false without copy support
+    bool shrink(Texture& texture, int level) {
+        const GLExtensions& gl = glExtensions();
+        if(!gl.copyImage) return false;
+        texture.uploadLevel = level;
+        allocateStorage(texture);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for(int l = level; l < texture.levels; l++) {
+            int width = std::max(1, texture.width >> l), height = std::max(1, texture.height >> l);
+            gl.copyImageSubData(texture.id, texture.target, l - texture.residentLevel, 0, 0, 0,
+                                texture.pendingId, texture.target, l - level, 0, 0, 0, width, height, texture.layers);
+        }
+        swapPending(texture);
+        return true;
+    }
+
+    // every layer read again and decoded on the pool, the uploads fill a new texture starting at level
+    void reload(uint32_t index, Texture& texture, int level) {
+        texture.uploadLevel = level;
+        texture.pendingLayers = texture.layers;
+        for(int layer = 0; layer < texture.layers; layer++) {
+            if(texture.sources[layer].empty()) {
+                layerDone(texture);
+                continue;
+            }
+            decode(index, texture.generation, layer, 0, nullptr, texture.sources[layer]);
+        }
+    }
+
+    // stone_tile.jpg -> stone_tile.ktx2
+    static std::string cookedPath(const std::string& path) {
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of('/');
+        if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + ".ktx2";
+        return path.substr(0, dot) + ".ktx2";
+    }
+
+    GLFormat glFormat(TextureFormat format) const {
+        bool srgbCompressed = srgb && glExtensions().textureCompressionS3TCSRGB;
+        switch(format) {
+            case FORMAT_RGB8:  return { GLenum(srgb ? GL_SRGB8 : GL_RGB8), GL_RGB, GL_UNSIGNED_BYTE };
+            case FORMAT_RGBA8: return { GLenum(srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8), GL_RGBA, GL_UNSIGNED_BYTE };
+            case FORMAT_BC1:
+                return { GLenum(srgbCompressed ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT),
+                         GL_RGB, GL_UNSIGNED_BYTE };
+            case FORMAT_BC3:
+                return { GLenum(srgbCompressed ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT),
+                         GL_RGBA, GL_UNSIGNED_BYTE };
+        }
+        return { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE };
+    }
+
+    GLuint sampler(Sampler which) {
+        GLuint& sampler = samplers[which];
+        if(sampler) return sampler;
+        bool nearest = which == SAMPLER_NEAREST_REPEAT;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, nearest ? GL_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, nearest ? GL_NEAREST : GL_LINEAR);
+        return sampler;
+    }
+
+    GLuint placeholderTexture(GLenum target) {
+        GLuint& texture = target == GL_TEXTURE_2D_ARRAY ? arrayPlaceholder : placeholder;
+        if(texture) return texture;
+        const unsigned char checker[] = {
+             96,  96,  96, 255,   160, 160, 160, 255,
+            160, 160, 160, 255,    96,  96,  96, 255,
+        };
+        glGenTextures(1, &texture);
+        glBindTexture(target, texture);
+        // one level, complete whatever sampler it is used with
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // a single layer, layer indices past it clamp to it
+        if(target == GL_TEXTURE_2D_ARRAY) {
+            glTexImage3D(target, 0, GL_RGBA8, 2, 2, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+        } else {
+            glTexImage2D(target, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        return texture;
+    }
+};
+
+inline TextureManager& textureManager() {
+    static TextureManager manager;
+    return manager;
+}
+#endif
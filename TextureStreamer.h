@@ -0,0 +1,177 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "TextureManager.h"
+
+/*
+ * Decides which mips each texture keeps on the GPU; TextureManager does the
+ * streaming. Every frame the renderer reports the surfaces it draws with
+ * request(), and the finest mip a texture needs follows from how many pixels
+ * one repeat of it covers on screen. A texture keeps a finer level for
+ * keepFrames after it was last needed, so mips don't bounce in and out as the
+ * camera moves. A texture whose size isn't known yet starts from its 1x1
+ * mip. Textures the streamer has never seen are left alone, but their memory
+ * still counts against the budget.
+ *
+ * When the wanted levels don't fit in budget bytes, textures give up mips in
+ * least recently used order: first those not seen this frame drop to their
+ * 1x1 level, then every texture, oldest first, drops one level at a time.
+ */
+class TextureStreamer {
+public:
+    size_t budget = 64 * 1024 * 1024;
+    // frames a finer mip is kept after the last frame that needed it
+    int keepFrames = 120;
+    // added to every wanted level, positive streams coarser
+    float bias = 0.0f;
+
+    struct Stats {
+        // textures with a request in the last keepFrames frames, and seen this frame
+        int tracked = 0;
+        int visible = 0;
+        // moving to another level
+        int streaming = 0;
+        // resident coarser than they want, because of the budget or still streaming
+        int coarser = 0;
+        size_t residentBytes = 0;
+        // what the wanted levels would take without a budget
+        size_t wantedBytes = 0;
+    };
+
+    void beginFrame(int screenHeight, float fovY) {
+        frame++;
+        pixelsPerUnit = screenHeight / (2.0f * std::tan(fovY / 2.0f));
+    }
+
+    // a surface drawn with texture this frame, one repeat of it covering worldSize units at distance
+    void request(TextureHandle texture, float worldSize, float distance) {
+        if(!texture) return;
+        const TextureManager::Texture& t = textureManager().get(texture);
+        Entry& entry = entries[texture.index];
+        if(entry.generation != t.generation || entry.lastUsed == 0) entry = Entry{ t.generation };
+        if(entry.lastUsed != frame) entry.wanted = MAX_LEVEL;
+        entry.lastUsed = frame;
+        if(t.levels == 0) return;
+
+        float pixels = worldSize * pixelsPerUnit / std::max(distance, 0.01f);
+        float texels = (float)std::max(t.width, t.height);
+        int level = (int)std::floor(std::log2(std::max(texels / std::max(pixels, 1.0f), 1.0f)) + bias);
+        entry.wanted = std::min(entry.wanted, std::max(0, std::min(level, t.levels - 1)));
+    }
+
+    // once per frame after the requests, before TextureManager::update
+    void update() {
+        TextureManager& manager = textureManager();
+        std::vector<uint32_t> order;
+        size_t total = 0;
+        for(uint32_t i = 1; i < manager.slotCount(); i++) {
+            const TextureManager::Texture& t = manager.get(TextureHandle{ i });
+            auto it = entries.find(i);
+            if(it != entries.end() && (t.refs == 0 || it->second.generation != t.generation)) {
+                entries.erase(it);
+                it = entries.end();
+            }
+            if(t.refs == 0) continue;
+            if(it == entries.end()) {
+                total += t.bytes;
+                continue;
+            }
+
+            Entry& entry = it->second;
+            if(t.levels == 0) {
+                // size unknown until decoded, start from the 1x1 mip and stream in from there
+                manager.setTargetLevel(TextureHandle{ i }, MAX_LEVEL);
+                continue;
+            }
+            int coarsest = t.levels - 1;
+            if(entry.lastUsed == frame) {
+                // finer levels stay for keepFrames, then follow what is wanted now
+                int wanted = std::min(entry.wanted, coarsest);
+                if(wanted <= entry.kept || frame - entry.keptFrame > (uint64_t)keepFrames) {
+                    entry.kept = wanted;
+                    entry.keptFrame = frame;
+                }
+                entry.level = entry.kept;
+            } else {
+                // unseen textures keep what they have until the budget needs it
+                entry.level = t.state == TextureManager::RESIDENT ? t.residentLevel : coarsest;
+            }
+            total += bytesAt(t, entry.level);
+            order.push_back(i);
+        }
+
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return entries[a].lastUsed < entries[b].lastUsed;
+        });
+        for(uint32_t i : order) {
+            if(total <= budget) break;
+            Entry& entry = entries[i];
+            if(entry.lastUsed == frame) break;
+            total = dropTo(manager.get(TextureHandle{ i }), entry, manager.get(TextureHandle{ i }).levels - 1, total);
+        }
+        for(bool dropped = true; total > budget && dropped;) {
+            dropped = false;
+            for(uint32_t i : order) {
+                if(total <= budget) break;
+                const TextureManager::Texture& t = manager.get(TextureHandle{ i });
+                if(entries[i].level >= t.levels - 1) continue;
+                total = dropTo(t, entries[i], entries[i].level + 1, total);
+                dropped = true;
+            }
+        }
+
+        for(uint32_t i : order) manager.setTargetLevel(TextureHandle{ i }, entries[i].level);
+    }
+
+    Stats stats() const {
+        Stats stats;
+        for(const auto& it : entries) {
+            const TextureManager::Texture& t = textureManager().get(TextureHandle{ it.first });
+            const Entry& entry = it.second;
+            if(t.refs == 0 || t.levels == 0 || frame - entry.lastUsed > (uint64_t)keepFrames) continue;
+            stats.tracked++;
+            if(entry.lastUsed == frame) stats.visible++;
+            if(t.uploadLevel >= 0) stats.streaming++;
+            if(t.state == TextureManager::RESIDENT && t.residentLevel > entry.kept) stats.coarser++;
+            stats.residentBytes += t.bytes;
+            stats.wantedBytes += bytesAt(t, entry.kept);
+        }
+        return stats;
+    }
+
+private:
+    static const int MAX_LEVEL = 32;
+
+    struct Entry {
+        uint32_t generation = 0;
+        uint64_t lastUsed = 0;
+        // finest level asked for this frame
+        int wanted = MAX_LEVEL;
+        // finest level needed within keepFrames, and when that started
+        int kept = MAX_LEVEL;
+        uint64_t keptFrame = 0;
+        // what update() settled on
+        int level = MAX_LEVEL;
+    };
+
+    uint64_t frame = 0;
+    float pixelsPerUnit = 1.0f;
+    std::unordered_map<uint32_t, Entry> entries;
+
+    static size_t bytesAt(const TextureManager::Texture& t, int level) {
+        return TextureImage::chainSize(t.format, t.width, t.height, std::min(level, t.levels - 1)) * t.layers;
+    }
+
+    size_t dropTo(const TextureManager::Texture& t, Entry& entry, int level, size_t total) const {
+        if(level <= entry.level) return total;
+        total -= bytesAt(t, entry.level);
+        entry.level = level;
+        return total + bytesAt(t, entry.level);
+    }
+};
+#endif
@@ -0,0 +1,51 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstring>
+#include "Uniforms.h"
+// FrameData, MaterialData etc. are generated from the GLSL block declarations
+#include "shader_layouts.h"
+
+/*
+ * One buffer per block, attached to its binding point once at init. Every
+ * program links its block of the same name to that point (see Shader), so a
+ * single upload is seen by all of them. Writes go to a CPU copy and only
+ * reach the GPU in upload(), and only if something actually changed.
+ */
+template<typename T>
+class UniformBuffer {
+public:
+    void init(GLuint binding) {
+        memset(&data, 0, sizeof(T));
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        dirty = false;
+    }
+
+    const T& get() const { return data; }
+
+    // marks the block dirty only when the value differs
+    template<typename V>
+    void set(V T::* field, const V& value) {
+        if(memcmp(&(data.*field), &value, sizeof(V)) == 0) return;
+        data.*field = value;
+        dirty = true;
+    }
+
+    void upload() {
+        if(!dirty) return;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        dirty = false;
+    }
+
+private:
+    T data;
+    GLuint buffer = 0;
+    bool dirty = true;
+};
+#endif
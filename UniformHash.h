@@ -0,0 +1,11 @@
+#ifndef UNIFORM_HASH_H
+#define UNIFORM_HASH_H
+
+#include <cstdint>
+
+// FNV-1a, constexpr so names can be hashed at compile time; GL-free so
+// shader_reflect can check the generated names for collisions
+constexpr uint32_t uniformHash(const char* name, uint32_t hash = 2166136261u) {
+    return *name ? uniformHash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "UniformHash.h"
+
+// a uniform name reduced to its hash, Shader looks locations up by it
+struct UniformId {
+    uint32_t hash;
+    constexpr explicit UniformId(uint32_t hash) : hash(hash) {}
+};
+
+constexpr UniformId operator""_u(const char* name, size_t) {
+    return UniformId(uniformHash(name));
+}
+
+// a uniform with its C++ value type, count > 1 for arrays; the project's
+// uniforms are generated into shader_layouts.h by shader_reflect
+template<typename T, int count = 1>
+struct Uniform {
+    UniformId id;
+    constexpr explicit Uniform(const char* name) : id(uniformHash(name)) {}
+};
+
+// binding points of the shared std140 blocks (see UniformBuffer.h)
+struct UniformBlock {
+    const char* name;
+    unsigned int binding;
+};
+
+const UniformBlock FRAME_DATA_BLOCK = { "FrameData", 0 };
+const UniformBlock MATERIAL_DATA_BLOCK = { "MaterialData", 1 };
+const UniformBlock UNIFORM_BLOCKS[] = { FRAME_DATA_BLOCK, MATERIAL_DATA_BLOCK };
+#endif
@@ -0,0 +1,179 @@
+#ifndef VIRTUAL_TEXTURE_FILE_H
+#define VIRTUAL_TEXTURE_FILE_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BlockCompression.h"
+#include "TextureImage.h"
+
+/*
+ * The tiled on-disk format virtual textures are paged in from (.vtex,
+ * written by texture_tool vtex). Every level of the image's mip chain is cut
+ * into pages of PAGE_SIZE x PAGE_SIZE texels, and each page is stored with
+ * BORDER texels of its neighbours around it, so bilinear filtering never
+ * reaches past a page once it sits in the page cache. Pages are BC1 and all
+ * the same size, so one read at an offset computed from the page's index
+ * loads any of them. No GL here, pages are read on worker threads.
+ *
+ * Width and height are powers of two and at least PAGE_SIZE, so level L is
+ * exactly max(1, (width >> L) / PAGE_SIZE) pages across, the size of mip L of
+ * a texture with one texel per page. Levels stop at the first one that fits
+ * in a single page.
+ *
+ * File layout: "VTEX", uint32 version, width, height, levels, format, then
+ * the pages level after level, finest first, each level row by row.
+ */
+class VirtualTextureFile {
+public:
+    static const int PAGE_SIZE = 128;
+    static const int BORDER = 4;
+    // a page with its border, also the size of a page cache slot; a multiple of the BC1 block size
+    static const int STORED_SIZE = PAGE_SIZE + 2 * BORDER;
+
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    TextureFormat format = FORMAT_BC1;
+
+    VirtualTextureFile() {}
+    VirtualTextureFile(const VirtualTextureFile&) = delete;
+    VirtualTextureFile& operator=(const VirtualTextureFile&) = delete;
+
+    ~VirtualTextureFile() {
+        if(fd >= 0) close(fd);
+    }
+
+    int pagesX(int level) const {
+        return std::max(1, (width >> level) / PAGE_SIZE);
+    }
+
+    int pagesY(int level) const {
+        return std::max(1, (height >> level) / PAGE_SIZE);
+    }
+
+    size_t pageBytes() const {
+        return TextureImage::levelSize(format, STORED_SIZE, STORED_SIZE);
+    }
+
+    // false with an error printed when the file is missing or doesn't match its header
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_SUCCESSFULLY_READ " << path << std::endl;
+            return false;
+        }
+        uint32_t header[5] = {};
+        char magic[4] = {};
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0 && pread(fd, magic, 4, 0) == 4
+               && pread(fd, header, sizeof(header), 4) == (ssize_t)sizeof(header)
+               && memcmp(magic, MAGIC, 4) == 0 && header[0] == VERSION && header[4] == FORMAT_BC1;
+        if(ok) {
+            width = (int)header[1];
+            height = (int)header[2];
+            levels = (int)header[3];
+            ok = isValidSize(width) && isValidSize(height) && levels == levelCount(width, height)
+              && (size_t)info.st_size == HEADER_SIZE + pageOffset(levels, 0, 0);
+        }
+        if(!ok) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::INVALID_FILE " << path << std::endl;
+            close(fd);
+            fd = -1;
+        }
+        return ok;
+    }
+
+    // one stored page, safe to call from several threads at once
+    bool readPage(int level, int x, int y, std::vector<unsigned char>& out) const {
+        out.resize(pageBytes());
+        off_t offset = (off_t)(HEADER_SIZE + pageOffset(level, x, y));
+        return pread(fd, out.data(), out.size(), offset) == (ssize_t)out.size();
+    }
+
+    static bool isValidSize(int size) {
+        return size >= PAGE_SIZE && (size & (size - 1)) == 0;
+    }
+
+    // finest level first, down to the one that fits in a page
+    static int levelCount(int width, int height) {
+        int levels = 1;
+        while(std::max(width >> (levels - 1), height >> (levels - 1)) > PAGE_SIZE) levels++;
+        return levels;
+    }
+
+    // chain is RGBA8 with power of two sizes and at least levelCount levels
+    static bool write(const std::string& path, const TextureImage& chain) {
+        VirtualTextureFile layout;
+        layout.width = chain.width;
+        layout.height = chain.height;
+        layout.levels = levelCount(chain.width, chain.height);
+        if(chain.format != FORMAT_RGBA8 || !isValidSize(chain.width) || !isValidSize(chain.height)
+           || chain.levels < layout.levels) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::UNSUPPORTED_IMAGE " << path << std::endl;
+            return false;
+        }
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if(!file) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        uint32_t header[5] = { VERSION, (uint32_t)layout.width, (uint32_t)layout.height,
+                               (uint32_t)layout.levels, (uint32_t)FORMAT_BC1 };
+        bool ok = fwrite(MAGIC, 1, 4, file) == 4 && fwrite(header, sizeof(uint32_t), 5, file) == 5;
+
+        std::vector<unsigned char> page((size_t)STORED_SIZE * STORED_SIZE * 4);
+        for(int level = 0; ok && level < layout.levels; level++) {
+            int levelWidth = chain.levelWidth(level), levelHeight = chain.levelHeight(level);
+            const unsigned char* pixels = chain.level(level);
+            for(int py = 0; ok && py < layout.pagesY(level); py++) {
+                for(int px = 0; ok && px < layout.pagesX(level); px++) {
+                    // the border and anything past a level smaller than a page repeat the edge texels
+                    for(int y = 0; y < STORED_SIZE; y++) {
+                        int sy = std::min(std::max(py * PAGE_SIZE - BORDER + y, 0), levelHeight - 1);
+                        for(int x = 0; x < STORED_SIZE; x++) {
+                            int sx = std::min(std::max(px * PAGE_SIZE - BORDER + x, 0), levelWidth - 1);
+                            memcpy(&page[((size_t)y * STORED_SIZE + x) * 4], pixels + ((size_t)sy * levelWidth + sx) * 4, 4);
+                        }
+                    }
+                    std::unique_ptr<TextureImage> source = TextureImage::fromBytes(
+                        std::vector<unsigned char>(page), FORMAT_RGBA8, STORED_SIZE, STORED_SIZE, 1);
+                    std::unique_ptr<TextureImage> compressed = compressImage(*source, FORMAT_BC1);
+                    // the output is sized for a whole chain, only the first level is filled
+                    ok = fwrite(compressed->level(0), 1, layout.pageBytes(), file) == layout.pageBytes();
+                }
+            }
+        }
+        ok = fclose(file) == 0 && ok;
+        if(!ok) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::CANNOT_WRITE " << path << std::endl;
+            remove(path.c_str());
+        }
+        return ok;
+    }
+
+private:
+    static constexpr const char* MAGIC = "VTEX";
+    static const uint32_t VERSION = 1;
+    static const size_t HEADER_SIZE = 4 + 5 * sizeof(uint32_t);
+
+    int fd = -1;
+
+    // from the first page; (levels, 0, 0) is the end of the pages
+    size_t pageOffset(int level, int x, int y) const {
+        size_t index = 0;
+        for(int l = 0; l < level; l++) index += (size_t)pagesX(l) * pagesY(l);
+        index += (size_t)y * pagesX(level) + x;
+        return index * pageBytes();
+    }
+};
+#endif
@@ -0,0 +1,488 @@
+#ifndef VIRTUAL_TEXTURES_H
+#define VIRTUAL_TEXTURES_H
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "BlockCompression.h"
+#include "GLExtensions.h"
+#include "ThreadPool.h"
+#include "VirtualTextureFile.h"
+#include "shader.h"
+
+/*
+ * Virtual texturing for surfaces with unique, non-repeating textures too big
+ * to keep on the GPU whole. Each virtual texture is a .vtex file
+ * (VirtualTextureFile.h) cut into pages, and only the pages the camera needs
+ * are kept, in one physical page cache texture shared by every virtual
+ * texture. No ARB_sparse_texture: the indirection happens in the shader
+ * (virtual_texture.glsl), so this runs on any 3.3 context.
+ *
+ * Each virtual texture has a page table texture with one RGBA8 texel per
+ * page and one mip per level, holding the cache slot's x and y and the level
+ * of the page in that slot. A page that isn't resident points at its nearest
+ * resident ancestor, so a lookup always lands on something, just blurrier
+ * until the page arrives. The coarsest page of every texture is loaded when
+ * it is opened and never evicted.
+ *
+ * Which pages are needed comes from a feedback pass. The virtual-textured
+ * surfaces are drawn into a small R32UI target (the viewport divided by
+ * feedbackDivisor) that records the page each pixel wants. The target is read
+ * back into a ring of pixel pack buffers, and each buffer is only mapped once
+ * its fence has signalled a frame or two later, so nothing stalls.
+ *
+ * Missing pages are read on the thread pool, coarsest first, and BC1 pages
+ * are decoded there when the GPU lacks S3TC. The render thread copies a few
+ * of them into their cache slots every frame. When the cache is full, the
+ * least recently requested page that wasn't needed in the latest feedback
+ * gives up its slot.
+ */
+class VirtualTextures {
+public:
+    // the cache holds cacheSlots x cacheSlots pages, set before the first open()
+    int cacheSlots = 16;
+    // the feedback target is the viewport divided by this in each direction
+    int feedbackDivisor = 8;
+    // page reads in flight at most, and pages copied into the cache per update()
+    int maxLoads = 32;
+    int uploadsPerFrame = 8;
+
+    struct Stats {
+        int textures = 0;
+        // cache slots holding a page, of slots
+        int resident = 0;
+        int slots = 0;
+        int loading = 0;
+        // distinct pages in the last feedback read back
+        int requested = 0;
+        int loaded = 0;
+        int evicted = 0;
+    };
+
+    // index of the opened texture, for Material::virtualTexture; -1 if the file can't be used
+    int open(const std::string& path) {
+        if(textures.size() >= MAX_TEXTURES) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_MANY_TEXTURES " << path << std::endl;
+            return -1;
+        }
+        std::unique_ptr<Texture> texture(new Texture());
+        if(!texture->file.open(path)) return -1;
+        const VirtualTextureFile& file = texture->file;
+        // the feedback encoding has 10 bits per page coordinate and 4 for the level
+        if(file.pagesX(0) > 1024 || file.pagesY(0) > 1024 || file.levels > 16) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE " << path << std::endl;
+            return -1;
+        }
+        if(!cache) createCache();
+
+        texture->path = path;
+        texture->entries.resize(file.levels);
+        texture->dirty.assign(file.levels, true);
+        for(int level = 0; level < file.levels; level++) {
+            texture->entries[level].assign((size_t)file.pagesX(level) * file.pagesY(level), 0);
+        }
+        glGenTextures(1, &texture->pageTable);
+        glBindTexture(GL_TEXTURE_2D, texture->pageTable);
+        if(glExtensions().textureStorage) {
+            glExtensions().texStorage2D(GL_TEXTURE_2D, file.levels, GL_RGBA8, file.pagesX(0), file.pagesY(0));
+        } else {
+            for(int level = 0; level < file.levels; level++) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, file.pagesX(level), file.pagesY(level), 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+        // only read with texelFetch, but it still has to be complete
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file.levels - 1);
+
+        int id = (int)textures.size();
+        textures.push_back(std::move(texture));
+        // what every other page falls back to
+        startLoad(pageKey(id, file.levels - 1, 0, 0));
+        return id;
+    }
+
+    // page table on unit, the page cache on unit + 1
+    void bind(int texture, int unit = 0) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, textures[texture]->pageTable);
+        glBindSampler(unit, 0);
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        glBindTexture(GL_TEXTURE_2D, cache);
+        glBindSampler(unit + 1, cacheSampler);
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // switches to the cleared feedback target; false while every readback buffer is still in flight
+    bool beginFeedback() {
+        if(textures.empty() || readbacks[nextReadback].fence) return false;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        int width = std::max(1, viewport[2] / feedbackDivisor);
+        int height = std::max(1, viewport[3] / feedbackDivisor);
+        if(width != feedbackWidth || height != feedbackHeight) createFeedbackTarget(width, height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, width, height);
+        const GLuint none[4] = { NO_PAGE, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, none);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return true;
+    }
+
+    // before drawing the surfaces of one texture with the feedback program bound
+    void setFeedbackTexture(Shader& shader, int texture) {
+        bind(texture, 0);
+        shader.set(uniforms::virtualTextureId, (unsigned int)texture);
+        // the target has feedbackDivisor times fewer pixels across, so its derivatives are that much larger
+        shader.set(uniforms::feedbackBias, -std::log2((float)feedbackDivisor));
+    }
+
+    // queues the readback and goes back to the default framebuffer and viewport
+    void endFeedback() {
+        Readback& readback = readbacks[nextReadback];
+        size_t size = (size_t)feedbackWidth * feedbackHeight * sizeof(uint32_t);
+        if(!readback.buffer) glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        if(readback.size != size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            readback.size = size;
+        }
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        nextReadback = (nextReadback + 1) % READBACK_COUNT;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // once per frame on the render thread
+    void update() {
+        if(textures.empty()) return;
+        collectFeedback();
+        uploadPages();
+        uploadPageTables();
+    }
+
+    Stats stats() const {
+        Stats stats;
+        stats.textures = (int)textures.size();
+        stats.resident = (int)resident.size();
+        stats.slots = (int)slots.size();
+        stats.loading = (int)loading.size();
+        stats.requested = requested;
+        stats.loaded = loaded;
+        stats.evicted = evicted;
+        return stats;
+    }
+
+private:
+    static const size_t MAX_TEXTURES = 255;
+    // what the feedback target is cleared to, texture 255 doesn't exist
+    static const uint32_t NO_PAGE = 0xFFFFFFFFu;
+    static const int READBACK_COUNT = 3;
+
+    struct Texture {
+        VirtualTextureFile file;
+        std::string path;
+        GLuint pageTable = 0;
+        // per level, one RGBA8 texel per page; 0 until some ancestor is resident
+        std::vector<std::vector<uint32_t>> entries;
+        std::vector<bool> dirty;
+    };
+
+    struct Slot {
+        uint32_t page = NO_PAGE;
+        // feedback frame the page was last needed in
+        uint64_t lastUsed = 0;
+        // a texture's coarsest page
+        bool pinned = false;
+    };
+
+    struct Readback {
+        GLuint buffer = 0;
+        size_t size = 0;
+        GLsync fence = nullptr;
+    };
+
+    struct LoadedPage {
+        uint32_t page;
+        bool ok;
+        std::vector<unsigned char> bytes;
+    };
+
+    std::vector<std::unique_ptr<Texture>> textures;
+    GLuint cache = 0;
+    GLuint cacheSampler = 0;
+    TextureFormat cacheFormat = FORMAT_BC1;
+    std::vector<Slot> slots;
+    // page -> slot
+    std::unordered_map<uint32_t, int> resident;
+    std::unordered_set<uint32_t> loading;
+    // pages that couldn't be read, not asked for again
+    std::unordered_set<uint32_t> failed;
+    std::deque<LoadedPage> ready;
+    uint64_t frame = 0;
+    int requested = 0;
+    int loaded = 0;
+    int evicted = 0;
+
+    GLuint feedbackFramebuffer = 0;
+    GLuint feedbackColor = 0;
+    GLuint feedbackDepth = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    GLint viewport[4] = {};
+    Readback readbacks[READBACK_COUNT];
+    int nextReadback = 0;
+
+    std::mutex loadedMutex;
+    std::vector<LoadedPage> finished;
+    // declared last so workers are joined before the files they read are closed
+    std::unique_ptr<ThreadPool> pool;
+
+    // the feedback pass writes the same encoding, see virtual_texture.glsl
+    static uint32_t pageKey(int texture, int level, int x, int y) {
+        return (uint32_t)x | (uint32_t)y << 10 | (uint32_t)level << 20 | (uint32_t)texture << 24;
+    }
+    static int pageTexture(uint32_t page) { return (int)(page >> 24); }
+    static int pageLevel(uint32_t page) { return (int)(page >> 20 & 0xF); }
+    static int pageX(uint32_t page) { return (int)(page & 0x3FF); }
+    static int pageY(uint32_t page) { return (int)(page >> 10 & 0x3FF); }
+
+    void createCache() {
+        cacheFormat = glExtensions().textureCompressionS3TC ? FORMAT_BC1 : FORMAT_RGBA8;
+        GLenum internalFormat = cacheFormat == FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8;
+        int size = cacheSlots * VirtualTextureFile::STORED_SIZE;
+        glGenTextures(1, &cache);
+        glBindTexture(GL_TEXTURE_2D, cache);
+        if(glExtensions().textureStorage) {
+            glExtensions().texStorage2D(GL_TEXTURE_2D, 1, internalFormat, size, size);
+        } else if(cacheFormat == FORMAT_BC1) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0,
+                                   (GLsizei)TextureImage::levelSize(cacheFormat, size, size), nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+        // page borders cover bilinear filtering, and there is only one level
+        glGenSamplers(1, &cacheSampler);
+        glSamplerParameteri(cacheSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(cacheSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(cacheSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(cacheSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        slots.assign((size_t)cacheSlots * cacheSlots, Slot());
+    }
+
+    void createFeedbackTarget(int width, int height) {
+        if(!feedbackFramebuffer) {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(1, &feedbackColor);
+            glGenRenderbuffers(1, &feedbackDepth);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_TARGET_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        feedbackWidth = width;
+        feedbackHeight = height;
+    }
+
+    // oldest readback first, stops at the first one the GPU hasn't finished
+    void collectFeedback() {
+        for(int k = 0; k < READBACK_COUNT; k++) {
+            Readback& readback = readbacks[(nextReadback + k) % READBACK_COUNT];
+            if(!readback.fence) continue;
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+
+            std::vector<uint32_t> pages;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            const uint32_t* pixels = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT);
+            if(pixels) {
+                pages.assign(pixels, pixels + readback.size / sizeof(uint32_t));
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if(pixels) requestPages(pages);
+        }
+    }
+
+    // marks what is resident as used and starts loading the rest, coarsest first
+    void requestPages(std::vector<uint32_t>& pages) {
+        frame++;
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        if(!pages.empty() && pages.back() == NO_PAGE) pages.pop_back();
+        requested = (int)pages.size();
+
+        std::vector<uint32_t> wanted;
+        for(uint32_t page : pages) {
+            int texture = pageTexture(page), level = pageLevel(page), x = pageX(page), y = pageY(page);
+            if(texture >= (int)textures.size()) continue;
+            const VirtualTextureFile& file = textures[texture]->file;
+            if(level >= file.levels || x >= file.pagesX(level) || y >= file.pagesY(level)) continue;
+            // coarser pages covering it too, they are what shows until it arrives
+            for(; level < file.levels; level++, x >>= 1, y >>= 1) {
+                uint32_t key = pageKey(texture, level, x, y);
+                auto it = resident.find(key);
+                if(it != resident.end()) slots[it->second].lastUsed = frame;
+                else if(!loading.count(key) && !failed.count(key)) wanted.push_back(key);
+            }
+        }
+        std::sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b) {
+            return pageLevel(a) != pageLevel(b) ? pageLevel(a) > pageLevel(b) : a < b;
+        });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        for(uint32_t page : wanted) {
+            if((int)loading.size() >= maxLoads) break;
+            startLoad(page);
+        }
+    }
+
+    void startLoad(uint32_t page) {
+        if(!pool) pool.reset(new ThreadPool());
+        loading.insert(page);
+        const VirtualTextureFile* file = &textures[pageTexture(page)]->file;
+        bool decompress = cacheFormat != FORMAT_BC1;
+        pool->submit([this, page, file, decompress]() {
+            LoadedPage result{ page, false, {} };
+            result.ok = file->readPage(pageLevel(page), pageX(page), pageY(page), result.bytes);
+            if(result.ok && decompress) {
+                int size = VirtualTextureFile::STORED_SIZE;
+                std::unique_ptr<TextureImage> compressed = TextureImage::fromBytes(std::move(result.bytes), FORMAT_BC1,
+                                                                                   size, size, 1);
+                std::unique_ptr<TextureImage> pixels = decompressImage(*compressed, FORMAT_RGBA8);
+                result.bytes.assign(pixels->data, pixels->data + pixels->size);
+            }
+            std::lock_guard<std::mutex> lock(loadedMutex);
+            finished.push_back(std::move(result));
+        });
+    }
+
+    void uploadPages() {
+        {
+            std::lock_guard<std::mutex> lock(loadedMutex);
+            for(LoadedPage& page : finished) ready.push_back(std::move(page));
+            finished.clear();
+        }
+        int size = VirtualTextureFile::STORED_SIZE;
+        for(int count = 0; count < uploadsPerFrame && !ready.empty(); count++) {
+            LoadedPage page = std::move(ready.front());
+            ready.pop_front();
+            loading.erase(page.page);
+            Texture& texture = *textures[pageTexture(page.page)];
+            if(!page.ok) {
+                std::cout << "ERROR::VIRTUAL_TEXTURE::PAGE_NOT_READ " << texture.path << " level " << pageLevel(page.page)
+                          << " page " << pageX(page.page) << ", " << pageY(page.page) << std::endl;
+                failed.insert(page.page);
+                continue;
+            }
+            // everything is needed right now, the next feedback asks again
+            int slot = allocateSlot();
+            if(slot < 0) continue;
+
+            glBindTexture(GL_TEXTURE_2D, cache);
+            int x = slot % cacheSlots * size, y = slot / cacheSlots * size;
+            if(cacheFormat == FORMAT_BC1) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, size, size, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                          (GLsizei)page.bytes.size(), page.bytes.data());
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, size, size, GL_RGBA, GL_UNSIGNED_BYTE, page.bytes.data());
+            }
+            int level = pageLevel(page.page);
+            slots[slot] = Slot{ page.page, frame, level == texture.file.levels - 1 };
+            resident[page.page] = slot;
+            refresh(pageTexture(page.page), level, pageX(page.page), pageY(page.page));
+            loaded++;
+        }
+    }
+
+    // a free slot, or the least recently used one not needed in the latest feedback; -1 if there is none
+    int allocateSlot() {
+        int victim = -1;
+        for(int i = 0; i < (int)slots.size(); i++) {
+            const Slot& slot = slots[i];
+            if(slot.page == NO_PAGE) return i;
+            if(slot.pinned || slot.lastUsed >= frame) continue;
+            if(victim < 0 || slot.lastUsed < slots[victim].lastUsed) victim = i;
+        }
+        if(victim < 0) return -1;
+        uint32_t page = slots[victim].page;
+        resident.erase(page);
+        slots[victim] = Slot();
+        refresh(pageTexture(page), pageLevel(page), pageX(page), pageY(page));
+        evicted++;
+        return victim;
+    }
+
+    // rewrites the entries of a page and every finer page under it, each pointing at
+    // its own slot when resident and at its parent's entry otherwise
+    void refresh(int id, int level, int x, int y) {
+        Texture& texture = *textures[id];
+        const VirtualTextureFile& file = texture.file;
+        for(int l = level, span = 1; l >= 0; l--, span *= 2) {
+            int x0 = x * span, y0 = y * span;
+            int x1 = std::min(x0 + span, file.pagesX(l)), y1 = std::min(y0 + span, file.pagesY(l));
+            for(int py = y0; py < y1; py++) {
+                for(int px = x0; px < x1; px++) {
+                    auto it = resident.find(pageKey(id, l, px, py));
+                    uint32_t entry = 0;
+                    if(it != resident.end()) {
+                        int slot = it->second;
+                        entry = (uint32_t)(slot % cacheSlots) | (uint32_t)(slot / cacheSlots) << 8
+                              | (uint32_t)l << 16 | 0xFFu << 24;
+                    } else if(l + 1 < file.levels) {
+                        entry = texture.entries[l + 1][(size_t)(py >> 1) * file.pagesX(l + 1) + (px >> 1)];
+                    }
+                    texture.entries[l][(size_t)py * file.pagesX(l) + px] = entry;
+                }
+            }
+            texture.dirty[l] = true;
+        }
+    }
+
+    // whole levels, they are a few KB at most
+    void uploadPageTables() {
+        for(size_t i = 0; i < textures.size(); i++) {
+            Texture& texture = *textures[i];
+            for(int level = 0; level < texture.file.levels; level++) {
+                if(!texture.dirty[level]) continue;
+                glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, texture.file.pagesX(level), texture.file.pagesY(level),
+                                GL_RGBA, GL_UNSIGNED_BYTE, texture.entries[level].data());
+                texture.dirty[level] = false;
+            }
+        }
+    }
+};
+
+inline VirtualTextures& virtualTextures() {
+    static VirtualTextures textures;
+    return textures;
+}
+#endif
@@ -1,16 +1,18 @@
 #ifndef SCENE_OBJECT_H
 #define SCENE_OBJECT_H 
 
+#include <algorithm>
 #include <vector>
+#include "AABB.h"
 #include "Plane.h"
 #include "vec3.h"
 #include "shader.h"
-#include "stb_image.h"
+#include "Material.h"
 #include "Mesh.h"
 
 class Wall {
     public:
-        Wall(Shader shader, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) : shader(shader), mesh(std::vector<Vertex>(), std::vector<unsigned int>()) {
+        Wall(Shader* shader, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) : shader(shader), mesh(std::vector<Vertex>(), std::vector<unsigned int>()) {
             plane = Plane(p1, p2, p3); 
             glm::vec3 p4 = p3 - (p2 - p1);
             glm::vec3 points[] = {p1, p2, p3, p4};
@@ -49,29 +51,72 @@ class Wall {
         }
 
         void draw() {
-            this->mesh.draw(shader);
+            material.bind();
+            this->mesh.draw(*shader);
         }
 
+        void drawGeometry() {
+            this->mesh.drawGeometry();
+        }
+
+        void setShader(Shader* shader) { this->shader = shader; }
+
         void setColor(float r, float g, float b) {
             // this->mesh.setColorvec3(r, g, b);
         }
 
+        // shared with every other wall using the same image
         void setTexture(const char* url) {
-            this->mesh.setTexture(url); 
-            // loadTexture();
+            TextureHandle texture = textureManager().load(url);
+            textureManager().release(material.diffuse);
+            material.diffuse = texture;
+            if(texture) this->mesh.fitTexCoords();
         }
 
+        // a layer of a packed texture array, carried to the shader in the vertices,
+        // or a virtual texture, which covers the wall once instead of repeating
+        void setMaterial(const Material& material) {
+            textureManager().retain(material.diffuse);
+            textureManager().release(this->material.diffuse);
+            this->material = material;
+            for(Vertex& v : this->mesh.vertices) v.Layer = (float)material.layer;
+            if(material.virtualTexture < 0) this->mesh.fitTexCoords();
+            else this->mesh.setup();
+        }
+
+        bool isVirtualTextured() const { return material.virtualTexture >= 0; }
+
+        Material& getMaterial() { return material; }
+
         Plane& getPlane() { return plane; }
 
+        Mesh& getMesh() { return mesh; }
+
         std::vector<glm::vec3>& getPoints() { return points; }
 
+        AABB getBounds() const {
+            AABB bounds;
+            for(auto& p : points) bounds.expand(p);
+            return bounds;
+        }
+
+        // world units one repeat of the texture covers, see Mesh::fitTexCoords
+        float getTextureSpan() const {
+            return std::min(glm::length(points[1] - points[0]), glm::length(points[2] - points[1]));
+        }
+
+        float getArea() const {
+            return glm::length(points[1] - points[0]) * glm::length(points[3] - points[0]);
+        }
+
         bool pointInside(const glm::vec3 point) {
             bool inside1 = pointInsideTriangle(point, plane.normal, points[0], points[1], points[3]);
             bool inside2 = pointInsideTriangle(point, plane.normal, points[1], points[2], points[3]);
             return inside1 || inside2;
         }
     private:
-        Shader shader; 
+        Shader* shader; 
+        Material material;
         Mesh mesh;
         std::vector<Vertex> meshVertices;
 
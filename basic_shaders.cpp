@@ -166,7 +166,7 @@ int main()
         float timeValue = glfwGetTime();
         float greenValue = (sin(timeValue) / 2.0f) + 0.5f;
 
-        myShader.set4Float("ourColor", 0.0f, greenValue, 0.0f, 0.0f);
+        myShader.set4Float("ourColor"_u, 0.0f, greenValue, 0.0f, 0.0f);
 
         glBindVertexArray(VAOs[0]);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
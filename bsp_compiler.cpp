@@ -0,0 +1,31 @@
+#include <iostream>
+
+#include "BSPCompiler.h"
+#include "Level.h"
+
+// Compiles the level's walls into a BSP tree with per-leaf visibility.
+// usage: bsp_compiler [output.bsp]
+int main(int argc, char** argv)
+{
+    const char* outPath = argc > 1 ? argv[1] : "level.bsp";
+
+    LevelDesc level = defaultLevel();
+    BSPCompiler compiler;
+    BSPTree tree = compiler.compile(level.walls, level.portals);
+    tree.levelHash = level.geometryHash();
+
+    if(!tree.save(outPath)) {
+        std::cerr << "Failed to write " << outPath << std::endl;
+        return 1;
+    }
+
+    size_t visibleWalls = 0;
+    for(uint8_t byte : tree.wallVisibility) visibleWalls += __builtin_popcount(byte);
+
+    std::cout << outPath << ": "
+              << tree.nodes.size() << " nodes, "
+              << tree.leafCount() << " leaves, "
+              << tree.wallCount << " walls, "
+              << (float)visibleWalls / tree.leafCount() << " visible walls per leaf" << std::endl;
+    return 0;
+}
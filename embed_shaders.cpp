@@ -0,0 +1,123 @@
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Generates a header with every shader source as string data, plus the names
+// each one tests with #ifdef/#ifndef/defined() (includes followed), so the
+// app never touches ./shaders at startup. See ShaderSources.h.
+// usage: embed_shaders output.h shaders/a.glsl shaders/b.glsl ...
+
+static std::string normalize(std::string path)
+{
+    while(path.compare(0, 2, "./") == 0) path.erase(0, 2);
+    return path;
+}
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    out = stream.str();
+    return true;
+}
+
+static void collectDefines(const std::string& path, std::set<std::string>& visited, std::set<std::string>& defines)
+{
+    if(!visited.insert(path).second) return;
+    std::string source;
+    if(!readFile(path, source)) return;
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+    std::istringstream lines(source);
+    std::string line;
+    while(std::getline(lines, line)) {
+        std::istringstream words(line);
+        std::string directive;
+        words >> directive;
+        if(directive == "#ifdef" || directive == "#ifndef") {
+            std::string name;
+            if(words >> name) defines.insert(name);
+        } else if(directive == "#if" || directive == "#elif") {
+            for(size_t at = line.find("defined"); at != std::string::npos; at = line.find("defined", at + 7)) {
+                size_t start = line.find_first_not_of(" (", at + 7);
+                size_t end = line.find_first_of(" )", start);
+                if(start != std::string::npos) defines.insert(line.substr(start, end - start));
+            }
+        } else if(directive == "#include") {
+            size_t open = line.find('"');
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if(close != std::string::npos) {
+                collectDefines(directory + line.substr(open + 1, close - open - 1), visited, defines);
+            }
+        }
+    }
+}
+
+static void writeLiteral(std::ostream& out, const std::string& source)
+{
+    out << "    \"";
+    for(char c : source) {
+        switch(c) {
+            case '\\': out << "\\\\"; break;
+            case '"':  out << "\\\""; break;
+            case '\r': break;
+            case '\n': out << "\\n\"\n    \""; break;
+            default:   out << c;
+        }
+    }
+    out << "\"";
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2) {
+        std::cerr << "usage: embed_shaders output.h shader.glsl..." << std::endl;
+        return 1;
+    }
+
+    std::ostringstream sources, table;
+    for(int i = 2; i < argc; i++) {
+        std::string path = normalize(argv[i]);
+        std::string source;
+        if(!readFile(path, source)) {
+            std::cerr << "Failed to read " << path << std::endl;
+            return 1;
+        }
+
+        std::set<std::string> visited, defines;
+        collectDefines(path, visited, defines);
+
+        sources << "constexpr char EMBEDDED_SOURCE_" << i - 2 << "[] =\n";
+        writeLiteral(sources, source);
+        sources << ";\n";
+        sources << "constexpr const char* EMBEDDED_DEFINES_" << i - 2 << "[] = { ";
+        for(const std::string& name : defines) sources << "\"" << name << "\", ";
+        sources << "nullptr };\n\n";
+
+        table << "    { \"" << path << "\", EMBEDDED_SOURCE_" << i - 2 << ", sizeof(EMBEDDED_SOURCE_" << i - 2
+              << ") - 1, EMBEDDED_DEFINES_" << i - 2 << " },\n";
+    }
+
+    std::ofstream out(argv[1]);
+    out << "// generated by embed_shaders, do not edit\n"
+        << "#ifndef SHADERS_EMBEDDED_H\n"
+        << "#define SHADERS_EMBEDDED_H\n\n"
+        << "// included by ShaderSources.h, which declares EmbeddedShader\n\n"
+        << sources.str()
+        << "constexpr EmbeddedShader EMBEDDED_SHADERS[] = {\n"
+        << table.str()
+        << "};\n"
+        << "#endif\n";
+    if(!out) {
+        std::cerr << "Failed to write " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << argv[1] << ": " << argc - 2 << " shaders" << std::endl;
+    return 0;
+}
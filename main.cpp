@@ -3,9 +3,9 @@
 #ifdef __APPLE__
 // Defined before OpenGL and GLUT includes to avoid deprecation messages
 #define GL_SILENCE_DEPRECATION
+#endif
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -19,7 +19,25 @@
 #include "Player.h"
 #include "sphere.h"
 #include "Wall.h"
-
+#include "Level.h"
+#include "Portals.h"
+#include "BSP.h"
+#include "OcclusionCuller.h"
+#include "GLExtensions.h"
+#include "GpuCuller.h"
+#include "OcclusionQueries.h"
+#include "UniformBuffer.h"
+#include "ShaderVariants.h"
+#include "ShaderWatcher.h"
+#include "FragmentCounter.h"
+#include "MaterialPacker.h"
+#include "TextureStreamer.h"
+#include "VirtualTextures.h"
+
+// stb_image picks SSE2 up by itself but only uses NEON when asked
+#if defined(__ARM_NEON)
+#define STBI_NEON
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -41,6 +59,24 @@ std::vector<Wall> worldColliders;
 Player player(glm::vec3(2.0001, 2.0, 0.0), 5.0, 0.5);
 bool phong = true;
 bool capture_mouse = true;
+// precomputed visibility from level.bsp instead of walking portals, when available
+bool use_pvs = true;
+bool occlusion_culling = true;
+// compute culling + multi-draw-indirect, only on 4.3+ contexts
+bool gpu_driven = true;
+// GPU occlusion queries on whatever survives CPU culling
+bool hardware_queries = true;
+// set by B, runs benchmarkSphere once at the start of the next frame
+bool run_sphere_benchmark = false;
+// depth-only pass before lighting, the level's default until Z toggles it
+bool depth_prepass = false;
+// set by M, prints the shaded fragment count of the last measured frame
+bool print_fragment_count = false;
+// set by T, prints texture streaming and virtual texture residency
+bool print_texture_stats = false;
+
+// walls at least this big get rasterized into the software depth buffer
+const float OCCLUDER_MIN_AREA = 20.0f;
 
 auto walls = std::vector<Wall>();
 
@@ -69,6 +105,38 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     {
         phong = !phong;
     }
+    if (key == GLFW_KEY_V && action == GLFW_PRESS)
+    {
+        use_pvs = !use_pvs;
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+    {
+        occlusion_culling = !occlusion_culling;
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        gpu_driven = !gpu_driven;
+    }
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS)
+    {
+        hardware_queries = !hardware_queries;
+    }
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+    {
+        depth_prepass = !depth_prepass;
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+    {
+        print_fragment_count = true;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+    {
+        print_texture_stats = true;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+    {
+        run_sphere_benchmark = true;
+    }
     if (key == GLFW_KEY_P && action == GLFW_PRESS) 
     {
         capture_mouse = !capture_mouse;
@@ -89,6 +157,72 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     player.getCamera().ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
+glm::mat3 normalMatrix(const glm::mat4& model)
+{
+    return glm::transpose(glm::inverse(glm::mat3(model)));
+}
+
+/*
+ * Vertex throughput of the lighting program on the 80k vertex sphere, timed
+ * on the GPU with GL_TIME_ELAPSED and on the CPU around glFinish (software
+ * drivers don't always implement the timer). Rasterization is discarded so
+ * only vertex work is measured. Runs the old per-vertex normal matrix
+ * (bench_normal_vertex.glsl) next to the current uniform for comparison.
+ */
+void benchmarkSphere(ShaderVariants& shaders, unsigned int VAO, GLsizei indexCount, GLsizei vertexCount)
+{
+    const int DRAWS = 50;
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), 0.5f, glm::vec3(0.3f, 1.0f, 0.0f));
+    model = glm::scale(model, glm::vec3(1.0f, 2.0f, 1.0f));
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(VAO);
+
+    // built once on the first run; no fallback, so it is linked before the constructor returns
+    static Shader baseline("./shaders/bench_normal_vertex.glsl", "./shaders/cont_fragment.glsl", nullptr, { "PHONG" });
+    Shader& current = shaders.get(FEATURE_PHONG);
+    current.wait();
+
+    const char* names[] = { "per-vertex inverse", "normalMatrix uniform" };
+    Shader* programs[] = { &baseline, &current };
+    for(int i = 0; i < 2; i++) {
+        Shader& shader = *programs[i];
+        shader.use();
+        shader.set(uniforms::model, model);
+        shader.set(uniforms::normalMatrix, normalMatrix(model));
+
+        // warm up, the first draw can include driver-side shader work
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+
+        glFinish();
+        double start = glfwGetTime();
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for(int d = 0; d < DRAWS; d++) {
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        glFinish();
+        double wallPerDraw = (glfwGetTime() - start) * 1e3 / DRAWS;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        double gpuPerDraw = nanoseconds / 1e6 / DRAWS;
+        // a timer reading 0 isn't implemented, throughput then comes from the wall time
+        double perDraw = gpuPerDraw > 0.0 ? gpuPerDraw : wallPerDraw;
+        std::cout << "sphere " << names[i] << ": ";
+        if(gpuPerDraw > 0.0) std::cout << gpuPerDraw << " ms GPU, ";
+        else std::cout << "no GPU timer, ";
+        std::cout << wallPerDraw << " ms wall per draw";
+        if(perDraw > 0.0) std::cout << ", " << vertexCount / perDraw / 1e3 << " M vertices/s";
+        std::cout << std::endl;
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    glDeleteQueries(1, &query);
+}
+
 int randomNum(int min, int max) {
     int range = max - min + 1;
     return rand() % range + min;
@@ -97,7 +231,8 @@ int randomNum(int min, int max) {
 int main()
 {
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // ask for 4.3 for the GPU-driven path, anything from 3.3 up still runs
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     #ifdef __APPLE__
@@ -107,6 +242,12 @@ int main()
 
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "LearnOpenGL", NULL, NULL);
     if (window == NULL)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(WIDTH, HEIGHT, "LearnOpenGL", NULL, NULL);
+    }
+    if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -125,6 +266,7 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    glExtensions().load((GLADloadproc)glfwGetProcAddress);
     glEnable(GL_DEPTH_TEST);  
 
     player.getCamera().setLastMouse(WIDTH / 2.0, HEIGHT / 2.0);
@@ -210,8 +352,9 @@ int main()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    //glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    //glEnableVertexAttribArray(1);
+    // unit sphere around the origin, so positions double as normals
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
 
     // LIGHT CUBE SETUP
     glBindVertexArray(cVAO);
@@ -230,130 +373,126 @@ int main()
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     // Create shader
-    Shader lightingShader("./shaders/cont_vertex.glsl", "./shaders/cont_fragment.glsl");
-    Shader lightCubeShader("./shaders/light_vertex.glsl", "./shaders/light_fragment.glsl");
+    // the flat program is tiny and built right away, the rest compile while the level loads
+    Shader flatShader("./shaders/light_vertex.glsl", "./shaders/flat_fragment.glsl");
+    Shader depthShader("./shaders/depth_vertex.glsl", "./shaders/depth_fragment.glsl");
+    ShaderVariants lightingShaders("./shaders/cont_vertex.glsl", "./shaders/cont_fragment.glsl", &flatShader);
+    // both lighting modes up front so toggling phong never waits on the compiler
+    const uint32_t wallFeatures = FEATURE_TEXTURED | FEATURE_TEXTURE_ARRAY;
+    lightingShaders.prepare(wallFeatures);
+    lightingShaders.prepare(wallFeatures | FEATURE_PHONG);
+    Shader* wallShader = &lightingShaders.get(wallFeatures | (phong ? FEATURE_PHONG : 0));
+    Shader lightCubeShader("./shaders/light_vertex.glsl", "./shaders/light_fragment.glsl", &flatShader);
 
     glm::vec3 lightPos(0.0f, 3.0f, 0.0f);
 
+    // shared by every program, see UniformBuffer.h
+    UniformBuffer<FrameData> frameData;
+    frameData.init(FRAME_DATA_BLOCK.binding);
+    frameData.set(&FrameData::lightPos, lightPos);
+    frameData.set(&FrameData::lightColor, glm::vec3(1.0f, 1.0f, 1.0f));
+
+    UniformBuffer<MaterialData> materialData;
+    materialData.init(MATERIAL_DATA_BLOCK.binding);
+    materialData.set(&MaterialData::objectColor, glm::vec3(0.5f, 0.5f, 0.5f));
 
-    auto floor = Wall(
-        lightingShader,
-        glm::vec3(-5, 0, -5),
-        glm::vec3(-5, 0,  5),
-        glm::vec3( 5, 0,  5)
-    );
-    auto wall1 = Wall(
-        lightingShader,
-        glm::vec3(-5, 0, -5),
-        glm::vec3(-5, 0,  5),
-        glm::vec3(-5, 3,  5)
-    );
-    auto wall2 = Wall(
-        lightingShader,
-        glm::vec3(-5, 0,  5),
-        glm::vec3( 5, 0,  5),
-        glm::vec3( 5, 3,  5)
-    );
-    auto wall3 = Wall(
-        lightingShader,
-        glm::vec3( 5, 0, -5),
-        glm::vec3(-5, 0, -5),
-        glm::vec3(-5, 3, -5)
-    );
-
-    auto gapWall1 = Wall(
-        lightingShader,
-        glm::vec3( 5, 0,  5),
-        glm::vec3( 5, 0,  2),
-        glm::vec3( 5, 3,  2)
-    );
-    auto gapWall2 = Wall(
-        lightingShader,
-        glm::vec3( 5, 0, -5),
-        glm::vec3( 5, 0, -2),
-        glm::vec3( 5, 3, -2)
-    );
-
-    auto floor2 = Wall(
-        lightingShader,
-        glm::vec3(10, 2, -5),
-        glm::vec3(10, 2,  5),
-        glm::vec3(30, 2,  5)
-    );
-    auto wall4 = Wall(
-        lightingShader,
-        glm::vec3(30, 2, -5),
-        glm::vec3(30, 2,  5),
-        glm::vec3(30, 5,  5)
-    );
-    auto wall5 = Wall(
-        lightingShader,
-        glm::vec3(10, 2,  5),
-        glm::vec3(30, 2,  5),
-        glm::vec3(30, 5,  5)
-    );
-    auto wall6 = Wall(
-        lightingShader,
-        glm::vec3(10, 2, -5),
-        glm::vec3(30, 2, -5),
-        glm::vec3(30, 5, -5)
-    );
-
-    auto gapWall3 = Wall(
-        lightingShader,
-        glm::vec3(10, 2,  5),
-        glm::vec3(10, 2,  2),
-        glm::vec3(10, 5,  2)
-    );
-    auto gapWall4 = Wall(
-        lightingShader,
-        glm::vec3(10, 2, -5),
-        glm::vec3(10, 2, -2),
-        glm::vec3(10, 5, -2)
-    );
-
-
-    auto ramp = Wall(
-        lightingShader,
-        glm::vec3(5, 0, 2),
-        glm::vec3(10, 2, 2),
-        glm::vec3(10, 2, -2)
-    );
-    auto tunnelWall1 = Wall(
-        lightingShader,
-        glm::vec3(5,  0, 2),
-        glm::vec3(10, 2, 2),
-        glm::vec3(10, 5, 2)
-    );
-    auto tunnelWall2 = Wall(
-        lightingShader,
-        glm::vec3(5,  0, -2),
-        glm::vec3(10, 2, -2),
-        glm::vec3(10, 5, -2)
-    );
-
-    walls.push_back(floor);
-    walls.push_back(wall1);
-    walls.push_back(wall2);
-    walls.push_back(wall3);
-    walls.push_back(floor2);
-    walls.push_back(wall4);
-    walls.push_back(wall5);
-    walls.push_back(wall6);
-    walls.push_back(gapWall1);
-    walls.push_back(gapWall2);
-    walls.push_back(gapWall3);
-    walls.push_back(gapWall4);
-    walls.push_back(ramp);
-    walls.push_back(tunnelWall1);
-    walls.push_back(tunnelWall2);
-
-    for(Wall& w: walls) {
-        player.addCollider(w);
-        w.setColor(0.6, 0.6, 0.6);  
-        const char* url = "stone_tile.jpg";
-        w.setTexture(url);
+
+    LevelDesc level = defaultLevel();
+    for(auto& desc : level.walls) {
+        walls.push_back(Wall(wallShader, desc.p1, desc.p2, desc.p3));
+    }
+    PortalGraph portals(level);
+    depth_prepass = level.depthPrepass;
+    int lightCell = level.cellAt(lightPos);
+
+    // built offline by bsp_compiler from the same level description
+    BSPTree bsp;
+    bool haveBsp = bsp.load("level.bsp") && bsp.wallCount == walls.size() && bsp.levelHash == level.geometryHash();
+    if(haveBsp) {
+        player.setBroadphase(&bsp);
+    } else {
+        std::cout << "level.bsp missing or stale, using portal visibility" << std::endl;
+    }
+    int lightLeaf = haveBsp ? bsp.findLeaf(lightPos) : -1;
+    std::vector<int> visibleWalls;
+    bool lightVisible;
+
+    AABB lightBounds(lightPos - glm::vec3(0.1f), lightPos + glm::vec3(0.1f));
+
+    OcclusionCuller occlusion;
+    std::vector<AABB> occludees;
+    std::vector<char> occludeeVisible;
+
+    // every wall texture in one array, each wall pointing at its layer; walls with a
+    // virtual texture page it in instead. VIRTUAL_TEXTURE_CACHE sets the cache size in pages across
+    if(const char* slots = getenv("VIRTUAL_TEXTURE_CACHE")) virtualTextures().cacheSlots = std::min(std::max(atoi(slots), 2), 255);
+    MaterialPacker packer;
+    std::vector<int> wallLayers;
+    std::vector<int> wallVirtualTextures;
+    for(auto& desc : level.walls) {
+        int virtualTexture = desc.virtualTexture ? virtualTextures().open(desc.virtualTexture) : -1;
+        wallVirtualTextures.push_back(virtualTexture);
+        wallLayers.push_back(virtualTexture < 0 ? packer.add(desc.texture) : -1);
+    }
+    Material wallMaterial;
+    wallMaterial.diffuse = packer.pack();
+
+    std::vector<int> virtualWalls;
+    for(size_t i = 0; i < walls.size(); i++) {
+        player.addCollider(walls[i]);
+        walls[i].setColor(0.6, 0.6, 0.6);  
+        if(wallVirtualTextures[i] >= 0) {
+            Material material;
+            material.virtualTexture = wallVirtualTextures[i];
+            walls[i].setMaterial(material);
+            virtualWalls.push_back((int)i);
+        } else {
+            wallMaterial.layer = wallLayers[i];
+            walls[i].setMaterial(wallMaterial);
+        }
     }
+    textureManager().release(wallMaterial.diffuse);
+
+    // their own lighting permutation, and the program writing which pages they need
+    std::unique_ptr<Shader> feedbackShader;
+    if(!virtualWalls.empty()) {
+        lightingShaders.prepare(FEATURE_VIRTUAL_TEXTURE);
+        lightingShaders.prepare(FEATURE_VIRTUAL_TEXTURE | FEATURE_PHONG);
+        Shader* virtualShader = &lightingShaders.get(FEATURE_VIRTUAL_TEXTURE | (phong ? FEATURE_PHONG : 0));
+        for(int i : virtualWalls) walls[i].setShader(virtualShader);
+        feedbackShader.reset(new Shader("./shaders/cont_vertex.glsl", "./shaders/vt_feedback_fragment.glsl"));
+    }
+
+    OcclusionQueries queries;
+    queries.init();
+
+    FragmentCounter fragmentCounter;
+    fragmentCounter.init();
+
+    bool gpuAvailable = GpuCuller::isSupported();
+    GpuCuller gpuCuller;
+    if(gpuAvailable) {
+        gpuCuller.init(walls);
+    } else {
+        std::cout << "GL " << glExtensions().major << "." << glExtensions().minor
+                  << " context, using CPU culling" << std::endl;
+    }
+
+    // startup benchmark: run twice, the second launch should be all cache hits. Async
+    // programs are only submitted here, "programs ready" below includes their compile and link
+    std::cout << "programs submitted in " << programCache().milliseconds << " ms" << std::endl;
+    bool programsReported = false;
+
+    // edit ./shaders while running, needs SHADER_OVERRIDE_DIR when shaders are embedded
+    ShaderWatcher shaderWatcher;
+    bool hotReload = ShaderSources::readsFromDisk() && shaderWatcher.start("shaders");
+
+    // textures decode in the background, report once the last one is resident
+    bool texturesReported = false;
+
+    // mips follow what is on screen; TEXTURE_BUDGET_MB caps GPU memory for textures
+    TextureStreamer textureStreamer;
+    if(const char* budget = getenv("TEXTURE_BUDGET_MB")) textureStreamer.budget = (size_t)(atof(budget) * 1024 * 1024);
 
     // render loop
     while(!glfwWindowShouldClose(window))
@@ -363,22 +502,47 @@ int main()
         lastFrame = currentFrame;
         // input
         processInput(window);
+        if(hotReload) shaderWatcher.update();
+        textureManager().update();
+        virtualTextures().update();
+        // polls without waiting where the driver compiles in parallel, otherwise collects them here
+        if(!programsReported) {
+            bool done = true;
+            for(Shader* shader : Shader::all()) done = shader->poll() && done;
+            if(done) {
+                programsReported = true;
+                std::cout << "programs ready after " << programCache().readyMilliseconds << " ms ("
+                          << programCache().hits << " cached, " << programCache().misses << " compiled"
+                          << (programCache().isEnabled() ? "" : ", no program binary support") << ")" << std::endl;
+            }
+        }
+        if(!texturesReported && textureManager().pendingCount() == 0) {
+            texturesReported = true;
+            std::cout << "textures resident after " << currentFrame * 1000.0f << " ms: "
+                      << textureManager().uniqueCount() << " unique of " << textureManager().requests << " requested, "
+                      << textureManager().decodes << " decoded, " << textureManager().cached << " cached, "
+                      << textureManager().totalBytes() / 1024 << " KB" << std::endl;
+        }
         player.tick(deltaTime);
 
+        if(run_sphere_benchmark) {
+            run_sphere_benchmark = false;
+            benchmarkSphere(lightingShaders, sVAO, (GLsizei)indices->size(), (GLsizei)(vertices->size() / 3));
+        }
+
         // set background
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // activate shader 
+        Shader& lightingShader = lightingShaders.get(wallFeatures | (phong ? FEATURE_PHONG : 0));
+        Shader* virtualShader = virtualWalls.empty() ? nullptr
+                              : &lightingShaders.get(FEATURE_VIRTUAL_TEXTURE | (phong ? FEATURE_PHONG : 0));
+        if(&lightingShader != wallShader) {
+            wallShader = &lightingShader;
+            for(Wall& w : walls) w.setShader(w.isVirtualTextured() ? virtualShader : wallShader);
+        }
         lightingShader.use();
-        lightingShader.setVec3("objectColor", 0.5f, 0.5f, 0.5f);
-        lightingShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-        lightingShader.setVec3("lightPos", lightPos);
-
-        unsigned int phongLoc = glGetUniformLocation(lightingShader.ID, "phong");
-        glUniform1i(phongLoc, phong);
-
-        lightingShader.setVec3("viewPos", player.getCamera().Position);
 
         glm::mat4 view       = glm::mat4(1.0f);
         glm::mat4 model      = glm::mat4(1.0f);
@@ -388,9 +552,61 @@ int main()
         projection = glm::perspective(glm::radians(player.getCamera().Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
         view = player.getCamera().GetViewMatrix();
 
-        glUniformMatrix4fv(glGetUniformLocation(lightingShader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(lightingShader.ID, "view"), 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(lightingShader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        frameData.set(&FrameData::view, view);
+        frameData.set(&FrameData::projection, projection);
+        frameData.set(&FrameData::viewPos, player.getCamera().Position);
+        frameData.upload();
+        materialData.upload();
+
+        lightingShader.set(uniforms::model, model);
+        lightingShader.set(uniforms::normalMatrix, normalMatrix(model));
+
+        if(virtualShader) {
+            virtualShader->use();
+            virtualShader->set(uniforms::model, model);
+            virtualShader->set(uniforms::normalMatrix, normalMatrix(model));
+            // the page table goes on unit 0, see VirtualTextures::bind
+            virtualShader->set(uniforms::pageCache, 1);
+        }
+
+        lightCubeShader.use();
+        glm::mat4 lightModel = glm::mat4(1.0f);
+        lightModel = glm::translate(lightModel, lightPos);
+        lightModel = glm::scale(lightModel, glm::vec3(0.2f));
+        lightCubeShader.set(uniforms::model, lightModel);
+
+        auto drawLightCube = [&]() {
+            lightCubeShader.use();
+            glBindVertexArray(cVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+        };
+
+        // depth of everything about to be drawn, then lighting with GL_EQUAL
+        // so each pixel runs the lighting shader once
+        auto depthPrepass = [&](bool gpu) {
+            depthShader.use();
+            depthShader.set(uniforms::model, model);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if(gpu) {
+                gpuCuller.draw();
+                for(int i : virtualWalls) walls[i].drawGeometry();
+            } else {
+                for(int i : visibleWalls) walls[i].drawGeometry();
+            }
+            if(lightVisible) {
+                depthShader.set(uniforms::model, lightModel);
+                glBindVertexArray(cVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        };
+
+        auto beginLightingPass = [&](bool gpu) {
+            if(depth_prepass) depthPrepass(gpu);
+            fragmentCounter.begin(!gpu && hardware_queries);
+        };
 
         // glBindVertexArray(sVAO);
         //
@@ -402,20 +618,139 @@ int main()
 
         // glDrawElements(GL_TRIANGLES, indices->size(), GL_UNSIGNED_INT, 0);
 
-        for(auto w: walls) {
-            w.draw(); 
+        if(gpuAvailable && gpu_driven) {
+            // the PVS row goes up as a coarse mask, frustum culling happens on the GPU
+            gpuCuller.setVisibilityMask(haveBsp && use_pvs ? bsp.wallRow(player.getCamera().Position) : nullptr);
+            gpuCuller.cull(projection * view);
+            lightVisible = true;
+            beginLightingPass(true);
+            lightingShader.use();
+            // all walls sample layers of the same array, so one binding covers the multi-draw
+            wallMaterial.bind();
+            gpuCuller.draw();
+            for(int i : virtualWalls) walls[i].draw();
+        } else {
+            visibleWalls.clear();
+            if(haveBsp && use_pvs) {
+                bsp.visibleWalls(player.getCamera().Position, visibleWalls);
+                lightVisible = bsp.isLeafVisible(bsp.findLeaf(player.getCamera().Position), lightLeaf);
+            } else {
+                portals.update(player.getCamera().Position, projection * view);
+                visibleWalls = portals.visibleWalls();
+                lightVisible = portals.isCellVisible(lightCell);
+            }
+
+            if(occlusion_culling) {
+                occlusion.clear();
+                occlusion.setViewProjection(projection * view);
+                occludees.clear();
+                for(int i : visibleWalls) {
+                    if(walls[i].getArea() >= OCCLUDER_MIN_AREA)
+                        occlusion.rasterizeQuad(walls[i].getPoints());
+                    occludees.push_back(walls[i].getBounds());
+                }
+                occludees.push_back(lightBounds);
+                occlusion.testVisibility(occludees, occludeeVisible);
+
+                size_t kept = 0;
+                for(size_t i = 0; i < visibleWalls.size(); i++) {
+                    if(occludeeVisible[i]) visibleWalls[kept++] = visibleWalls[i];
+                }
+                visibleWalls.resize(kept);
+                lightVisible = lightVisible && occludeeVisible.back();
+            }
+
+            beginLightingPass(false);
+            if(hardware_queries) {
+                // the light cube rides along as one more object after the walls
+                int lightId = (int)walls.size();
+                if(lightVisible) visibleWalls.push_back(lightId);
+                lightVisible = false;
+
+                queries.beginFrame(player.getCamera().Position);
+                queries.render(visibleWalls,
+                    [&](int id) { return id == lightId ? lightBounds : walls[id].getBounds(); },
+                    [&](int id) {
+                        if(id == lightId) drawLightCube();
+                        else walls[id].draw();
+                    });
+            } else {
+                for(int i : visibleWalls) {
+                    walls[i].draw();
+                }
+            }
         }
 
-        lightCubeShader.use();
-        glUniformMatrix4fv(glGetUniformLocation(lightCubeShader.ID, "view"), 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(lightCubeShader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, lightPos);
-        model = glm::scale(model, glm::vec3(0.2f));
-        glUniformMatrix4fv(glGetUniformLocation(lightCubeShader.ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        if(lightVisible) {
+            drawLightCube();
+        }
+
+        fragmentCounter.end();
+        if(depth_prepass) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        if(print_fragment_count) {
+            print_fragment_count = false;
+            std::cout << "shaded fragments: " << fragmentCounter.lastCount
+                      << (fragmentCounter.isPipelineStatistics() ? " (shader invocations" : " (samples passed")
+                      << ", depth pre-pass " << (depth_prepass ? "on" : "off") << ")" << std::endl;
+        }
 
-        glBindVertexArray(cVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        // the pages the virtual-textured walls need, drawn small with the other walls
+        // hiding them and read back a few frames later
+        if(feedbackShader && virtualTextures().beginFeedback()) {
+            depthShader.use();
+            depthShader.set(uniforms::model, model);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if(gpuAvailable && gpu_driven) {
+                gpuCuller.draw();
+            } else {
+                for(int i : visibleWalls) {
+                    if(i < (int)walls.size() && !walls[i].isVirtualTextured()) walls[i].drawGeometry();
+                }
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            feedbackShader->use();
+            feedbackShader->set(uniforms::model, model);
+            feedbackShader->set(uniforms::normalMatrix, normalMatrix(model));
+            for(int i : virtualWalls) {
+                virtualTextures().setFeedbackTexture(*feedbackShader, walls[i].getMaterial().virtualTexture);
+                walls[i].drawGeometry();
+            }
+            virtualTextures().endFeedback();
+        }
+
+        // the GPU path doesn't know which walls survived culling, so it asks for all of them
+        textureStreamer.beginFrame(HEIGHT, glm::radians(player.getCamera().Zoom));
+        auto requestTexture = [&](Wall& w) {
+            textureStreamer.request(w.getMaterial().diffuse, w.getTextureSpan(),
+                                    w.getBounds().distance(player.getCamera().Position));
+        };
+        if(gpuAvailable && gpu_driven) {
+            for(Wall& w : walls) requestTexture(w);
+        } else {
+            for(int i : visibleWalls) {
+                if(i < (int)walls.size()) requestTexture(walls[i]);
+            }
+        }
+        textureStreamer.update();
+        if(print_texture_stats) {
+            print_texture_stats = false;
+            TextureStreamer::Stats stats = textureStreamer.stats();
+            std::cout << "textures: " << stats.tracked << " tracked, " << stats.visible << " visible, "
+                      << stats.streaming << " streaming, " << stats.coarser << " coarser than wanted, "
+                      << stats.residentBytes / 1024 << " KB resident of " << stats.wantedBytes / 1024 << " KB wanted, "
+                      << "budget " << textureStreamer.budget / 1024 << " KB, "
+                      << textureManager().streamedIn << " streamed in, " << textureManager().evicted << " evicted" << std::endl;
+            if(!virtualWalls.empty()) {
+                VirtualTextures::Stats pages = virtualTextures().stats();
+                std::cout << "virtual textures: " << pages.textures << " open, " << pages.resident << " of "
+                          << pages.slots << " cache pages used, " << pages.requested << " requested by the last feedback, "
+                          << pages.loading << " loading, " << pages.loaded << " loaded, " << pages.evicted << " evicted"
+                          << std::endl;
+            }
+        }
 
         // call events + swap buffers
         glfwSwapBuffers(window);
@@ -2,7 +2,20 @@
 #define SHADER_H
 
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
+#include <glm/glm.hpp>
+#include "GLExtensions.h"
+#include "ProgramCache.h"
+#include "ShaderSources.h"
+#include "Uniforms.h"
+#include "shader_layouts.h"
   
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <set>
+#include <vector>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -17,95 +30,445 @@ public:
   
     // constructor reads and builds the shader
     Shader(const char* vertexPath, const char* fragmentPath) {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
+        build({ Stage{ GL_VERTEX_SHADER, "VERTEX", vertexPath },
+                Stage{ GL_FRAGMENT_SHADER, "FRAGMENT", fragmentPath } });
+    }
+
+    /*
+     * Asynchronous variant: both stages are submitted and linked without
+     * asking for the result, and until the driver is done use() binds a
+     * private copy of the fallback program instead, so pending shaders
+     * sharing one fallback don't overwrite each other's uniforms. Uniforms
+     * set in the meantime are replayed onto the real program once it links.
+     * With KHR_parallel_shader_compile completion is polled once per use()
+     * and never waits; without it the result is collected on the first use().
+     * Every name in defines becomes a "#define NAME" in both stages.
+     */
+    Shader(const char* vertexPath, const char* fragmentPath, Shader* fallback,
+           const std::vector<std::string>& defines = {}) : fallback(fallback), defines(defines) {
+        build({ Stage{ GL_VERTEX_SHADER, "VERTEX", vertexPath },
+                Stage{ GL_FRAGMENT_SHADER, "FRAGMENT", fragmentPath } });
+        if(building && fallback) standIn.reset(new Shader(fallback->stages, fallback->defines));
+    }
+
+    // compute-only program, needs a 4.3 context
+    explicit Shader(const char* computePath) {
+        build({ Stage{ GL_COMPUTE_SHADER, "COMPUTE", computePath } });
+    }
+
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    ~Shader() {
+        std::vector<Shader*>& shaders = all();
+        shaders.erase(std::remove(shaders.begin(), shaders.end(), this), shaders.end());
+    }
+
+    // every live program, for ShaderWatcher
+    static std::vector<Shader*>& all() {
+        static std::vector<Shader*> shaders;
+        return shaders;
+    }
+
+    // every file the current sources were read from, includes too, e.g. "shaders/frame_data.glsl"
+    const std::set<std::string>& sourceFiles() const { return dependencies; }
+
+    /*
+     * Rebuilds from the current sources into a second program object. The
+     * old program stays bound and usable until the new one links; on
+     * failure it is simply kept. Finishes like the async constructor, so
+     * with parallel compile the swap happens in a later use().
+     */
+    void reload() {
+        if(building) finish();
+        reloadStart = std::chrono::steady_clock::now();
+        start(glCreateProgram(), std::vector<Stage>(stages));
+        if(building && !glExtensions().parallelCompile) finish();
+    }
+
+    // use/activate the shader
+    void use() {
+        poll();
+        glUseProgram(ready || !standIn ? ID : standIn->ID);
+    }
+
+    // true once the program itself is linked, never blocks with parallel compile
+    bool poll() {
+        if(!building) return true;
+        if(glExtensions().parallelCompile) {
+            GLint done = GL_FALSE;
+            glGetProgramiv(building, GL_COMPLETION_STATUS_KHR, &done);
+            if(!done) return ready;
+        }
+        finish();
+        return true;
+    }
+
+    bool isReady() const { return ready; }
+
+    // blocks until the pending build is collected, for timing the real program rather than the fallback
+    void wait() {
+        if(building) finish();
+    }
+
+    // pre-resolved handle, -1 when the program has no such uniform
+    GLint location(UniformId id) const {
+        if(!ready && standIn) return standIn->location(id);
+        if(uniformTable.empty()) return -1;
+        uint32_t mask = (uint32_t)uniformTable.size() - 1;
+        for(uint32_t i = id.hash & mask; ; i = (i + 1) & mask) {
+            const UniformSlot& slot = uniformTable[i];
+            if(slot.hash == id.hash) return slot.location;
+            if(slot.hash == 0) return -1;
+        }
+    }
+
+    // typed setters for the generated slots in shader_layouts.h
+    template<typename T>
+    void set(Uniform<T> uniform, const T& value) const {
+        write(uniform.id, [value](GLint loc) { upload(loc, &value, 1); });
+    }
+    template<typename T, int count>
+    void set(Uniform<T, count> uniform, const T (&values)[count]) const {
+        std::vector<T> copy(values, values + count);
+        write(uniform.id, [copy](GLint loc) { upload(loc, copy.data(), count); });
+    }
+
+    // utility uniform functions
+    void setBool(UniformId name, bool value) const {
+        write(name, [value](GLint loc) { glUniform1i(loc, (int)value); });
+    }
+    void setInt(UniformId name, int value) const {
+        write(name, [value](GLint loc) { glUniform1i(loc, value); });
+    }
+    void setUInt(UniformId name, unsigned int value) const {
+        write(name, [value](GLint loc) { glUniform1ui(loc, value); });
+    }
+    void setFloat(UniformId name, float value) const {
+        write(name, [value](GLint loc) { glUniform1f(loc, value); });
+    }
+
+    void set4Float(UniformId name, float v1, float v2, float v3, float v4) const {
+        write(name, [v1, v2, v3, v4](GLint loc) { glUniform4f(loc, v1, v2, v3, v4); });
+    }
+    void setVec4Array(UniformId name, const glm::vec4* values, int count) const {
+        std::vector<glm::vec4> copy(values, values + count);
+        write(name, [copy](GLint loc) { glUniform4fv(loc, (GLsizei)copy.size(), &copy[0][0]); });
+    }
+
+    void setVec3(UniformId name, float v1, float v2, float v3) const {
+        write(name, [v1, v2, v3](GLint loc) { glUniform3f(loc, v1, v2, v3); });
+    }
+    void setVec3(UniformId name, glm::vec3 vec) const {
+        write(name, [vec](GLint loc) { glUniform3f(loc, vec.x, vec.y, vec.z); });
+    }
+
+    void setMat4(UniformId name, const glm::mat4& mat) const {
+        write(name, [mat](GLint loc) { glUniformMatrix4fv(loc, 1, GL_FALSE, &mat[0][0]); });
+    }
+
+private:
+    struct DeferredUniform {
+        UniformId id;
+        std::function<void(GLint)> upload;
+    };
+    // last value of every uniform set while a build was pending, for the program it produces
+    mutable std::vector<DeferredUniform> deferred;
+
+    // sets the uniform on the bound program, and remembers it while another build is on the way
+    template<typename F>
+    void write(UniformId id, F apply) const {
+        apply(location(id));
+        if(!building) return;
+        for(DeferredUniform& d : deferred) {
+            if(d.id.hash == id.hash) {
+                d.upload = apply;
+                return;
+            }
+        }
+        deferred.push_back(DeferredUniform{ id, apply });
+    }
+
+    // setters expect the program to be bound, so bind it for the replay and put back what was
+    void replayDeferred(GLuint previous) {
+        GLint bound = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &bound);
+        glUseProgram(ID);
+        for(DeferredUniform& d : deferred) d.upload(location(d.id));
+        glUseProgram((GLuint)bound == previous ? ID : (GLuint)bound);
+    }
+
+    static void upload(GLint loc, const float* v, int n)        { glUniform1fv(loc, n, v); }
+    static void upload(GLint loc, const int* v, int n)          { glUniform1iv(loc, n, v); }
+    static void upload(GLint loc, const unsigned int* v, int n) { glUniform1uiv(loc, n, v); }
+    static void upload(GLint loc, const glm::vec2* v, int n)    { glUniform2fv(loc, n, &v[0][0]); }
+    static void upload(GLint loc, const glm::vec3* v, int n)    { glUniform3fv(loc, n, &v[0][0]); }
+    static void upload(GLint loc, const glm::vec4* v, int n)    { glUniform4fv(loc, n, &v[0][0]); }
+    static void upload(GLint loc, const glm::mat3* v, int n)    { glUniformMatrix3fv(loc, n, GL_FALSE, &v[0][0][0]); }
+    static void upload(GLint loc, const glm::mat4* v, int n)    { glUniformMatrix4fv(loc, n, GL_FALSE, &v[0][0][0]); }
+    static void upload(GLint loc, const bool* v, int n) {
+        for(int i = 0; i < n; i++) glUniform1i(loc + i, v[i]);
+    }
+
+    struct UniformSlot {
+        uint32_t hash;
+        GLint location;
+    };
+    // open addressing on the name hash, power of two size, hash 0 is empty
+    std::vector<UniformSlot> uniformTable;
+
+    // one pass over the active uniforms right after linking
+    void buildUniformTable() {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        size_t size = 8;
+        while(size < (size_t)count * 2) size *= 2;
+        uniformTable.assign(size, UniformSlot{ 0, -1 });
 
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        std::vector<char> name(maxLength + 1);
+        for(GLint i = 0; i < count; i++) {
+            GLint arraySize;
+            GLenum type;
+            glGetActiveUniform(ID, i, (GLsizei)name.size(), NULL, &arraySize, &type, name.data());
+            GLint loc = glGetUniformLocation(ID, name.data());
+            // members of uniform blocks have no location
+            if(loc < 0) continue;
+
+            // arrays are reported as "name[0]", look them up by "name"
+            std::string key = name.data();
+            size_t bracket = key.find('[');
+            if(bracket != std::string::npos) key.resize(bracket);
+
+            uint32_t hash = uniformHash(key.c_str());
+            uint32_t mask = (uint32_t)size - 1;
+            uint32_t slot = hash & mask;
+            while(uniformTable[slot].hash != 0 && uniformTable[slot].hash != hash) {
+                slot = (slot + 1) & mask;
+            }
+            // two names, one hash: neither can be told apart, so both become -1
+            // rather than one quietly writing the other (shader_reflect rejects these)
+            if(uniformTable[slot].hash == hash) {
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << key << std::endl;
+                uniformTable[slot].location = -1;
+                continue;
+            }
+            uniformTable[slot] = UniformSlot{ hash, loc };
+        }
+    }
+
+    /*
+     * Resolves #include "file" relative to the including file, each file at
+     * most once, and puts the defines right after #version (which GLSL
+     * requires to come first). Every file read is added to files.
+     */
+    static std::string preprocess(const char* path, const std::vector<std::string>& defines,
+                                  std::set<std::string>& files) {
+        std::set<std::string> included;
+        std::string code = expandIncludes(ShaderSources::normalize(path), included, 0);
+        files.insert(included.begin(), included.end());
+
+        std::string header;
+        for(const std::string& name : defines) header += "#define " + name + "\n";
+        size_t insertAt = 0;
+        size_t version = code.find("#version");
+        if(version != std::string::npos) {
+            size_t end = code.find('\n', version);
+            insertAt = end == std::string::npos ? code.size() : end + 1;
+        }
+        code.insert(insertAt, header);
+        return code;
+    }
+
+    static std::string expandIncludes(const std::string& path, std::set<std::string>& included, int depth) {
+        if(depth > 16) {
+            std::cout << "ERROR::SHADER::INCLUDE_TOO_DEEP " << path << std::endl;
+            return std::string();
+        }
+        included.insert(path);
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+        std::istringstream source(readFile(path.c_str()));
+        std::string line, code;
+        while(std::getline(source, line)) {
+            size_t start = line.find_first_not_of(" \t");
+            if(start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+                size_t open = line.find('"', start);
+                size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+                if(close == std::string::npos) {
+                    std::cout << "ERROR::SHADER::BAD_INCLUDE " << path << ": " << line << std::endl;
+                    continue;
+                }
+                std::string file = directory + line.substr(open + 1, close - open - 1);
+                if(!included.count(file)) code += expandIncludes(file, included, depth + 1);
+                continue;
+            }
+            code += line + "\n";
+        }
+        return code;
+    }
+
+    static std::string readFile(const char* path) {
+        const EmbeddedShader* embedded = ShaderSources::find(path);
+        if(embedded) return std::string(embedded->source, embedded->size);
+
+        std::ifstream file;
+        file.exceptions (std::ifstream::failbit | std::ifstream::badbit);
         try
         {
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
+            file.open(ShaderSources::diskPath(path));
+            std::stringstream stream;
             // read file's buffer into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream to string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            stream << file.rdbuf();
+            file.close();
+            return stream.str();
         }
         catch(const std::exception& e)
         {
-            std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+            std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ " << ShaderSources::diskPath(path) << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
+        return std::string();
+    }
 
-        unsigned int vertex, fragment;
-        int success;
-        char infoLog[512];
+    struct Stage {
+        GLenum type;
+        const char* label;
+        std::string path;
+        std::string code;
+        unsigned int shader;
+    };
 
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-        if(!success) {
-            glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-        }
+    // builds a synchronous copy of another shader's program, for standIn
+    Shader(const std::vector<Stage>& stages, const std::vector<std::string>& defines) : defines(defines) {
+        build(stages);
+    }
 
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-        if(!success) {
-            glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-        }
+    Shader* fallback = nullptr;
+    // this shader's own copy of fallback's program, bound until the first build links
+    std::unique_ptr<Shader> standIn;
+    std::vector<std::string> defines;
+    // what the program was built from, kept for reload()
+    std::vector<Stage> stages;
+    std::set<std::string> dependencies;
+    // ID can be used, which is false only until the first build finishes
+    bool ready = false;
+    // program being compiled (ID itself on the first build), 0 when idle
+    GLuint building = 0;
+    std::vector<Stage> pending;
+    uint64_t pendingKey = 0;
+    std::chrono::steady_clock::time_point reloadStart;
+
+    void build(std::vector<Stage> stages) {
+        ProgramCache::Timer timer(programCache());
+        programCache().buildStarted();
+        all().push_back(this);
+        this->stages = stages;
 
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        glGetProgramiv(ID, GL_LINK_STATUS, &success);
-        if(!success) {
-            glGetProgramInfoLog(ID, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        start(ID, std::move(stages));
+        if(building && !fallback) finish();
+    }
+
+    // reads and submits the stages into program, or loads it from the cache
+    void start(GLuint program, std::vector<Stage> stages) {
+        // tracked from here on, so edits made while this compiles still count
+        dependencies.clear();
+        std::vector<const std::string*> sources;
+        for(Stage& stage : stages) {
+            stage.code = preprocess(stage.path.c_str(), defines, dependencies);
+            sources.push_back(&stage.code);
+        }
+        pendingKey = programCache().key(sources);
+        building = program;
+        if(programCache().load(program, pendingKey)) {
+            swapIn(true);
+            return;
         }
-        
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
 
+        // only submit here, any status query would wait for the compiler
+        for(Stage& stage : stages) {
+            const char* source = stage.code.c_str();
+            stage.shader = glCreateShader(stage.type);
+            glShaderSource(stage.shader, 1, &source, NULL);
+            glCompileShader(stage.shader);
+            glAttachShader(program, stage.shader);
+        }
+        programCache().prepare(program);
+        glLinkProgram(program);
+        pending = std::move(stages);
     }
-    // use/activate the shader
-    void use() {
-        glUseProgram(ID);
-    }
-    // utility uniform functions
-    void setBool(const std::string &name, bool value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+
+    // collects compile and link results, may block if the driver isn't done
+    void finish() {
+        for(Stage& stage : pending) {
+            checkStage(stage.shader, stage.label);
+            glDetachShader(building, stage.shader);
+            glDeleteShader(stage.shader);
+        }
+        pending.clear();
+
+        bool linked = checkLink(building);
+        if(linked) programCache().store(building, pendingKey);
+        swapIn(linked);
     }
-    void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+
+    void swapIn(bool linked) {
+        GLuint previous = ID;
+        if(building != ID) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - reloadStart;
+            if(linked) {
+                glDeleteProgram(ID);
+                ID = building;
+                std::cout << "reloaded " << stages.back().path << " in " << elapsed.count() << " ms" << std::endl;
+            } else {
+                glDeleteProgram(building);
+                std::cout << "ERROR::SHADER::RELOAD_FAILED keeping the previous " << stages.back().path << std::endl;
+            }
+        }
+        if(!ready) programCache().buildFinished();
+        building = 0;
+        if(linked || !ready) reflect();
+        ready = true;
+        if(linked && !deferred.empty()) replayDeferred(previous);
+        deferred.clear();
     }
-    void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+
+    static void checkStage(unsigned int shader, const char* label) {
+        int success;
+        char infoLog[512];
+
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if(!success) {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::" << label << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+        }
     }
 
-    void set4Float(const std::string &name, float v1, float v2, float v3, float v4) const {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), v1, v2, v3, v4);
+    static bool checkLink(GLuint program) {
+        int success;
+        char infoLog[512];
+
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if(!success) {
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        }
+        return success;
     }
 
-    void setVec3(const std::string &name, float v1, float v2, float v3) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), v1, v2, v3);
+    // per-program state that has to be rebuilt however the program was linked
+    void reflect() {
+        buildUniformTable();
+        bindUniformBlocks();
     }
-    void setVec3(const std::string &name, glm::vec3 vec) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), vec.x, vec.y, vec.z);
+
+    // GL 3.3 has no layout(binding = n) for blocks, so wire them up by name
+    void bindUniformBlocks() {
+        for(const UniformBlock& block : UNIFORM_BLOCKS) {
+            GLuint index = glGetUniformBlockIndex(ID, block.name);
+            if(index != GL_INVALID_INDEX) glUniformBlockBinding(ID, index, block.binding);
+        }
     }
 
 };
@@ -0,0 +1,61 @@
+// generated by shader_reflect from shaders/*.glsl, do not edit
+#ifndef SHADER_LAYOUTS_H
+#define SHADER_LAYOUTS_H
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "Uniforms.h"
+
+// std140 uniform blocks
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float pad0[1];
+    glm::vec3 lightPos;
+    float pad1[1];
+    glm::vec3 lightColor;
+    float pad2[1];
+};
+static_assert(offsetof(FrameData, view) == 0, "std140 offset of FrameData.view");
+static_assert(offsetof(FrameData, projection) == 64, "std140 offset of FrameData.projection");
+static_assert(offsetof(FrameData, viewPos) == 128, "std140 offset of FrameData.viewPos");
+static_assert(offsetof(FrameData, lightPos) == 144, "std140 offset of FrameData.lightPos");
+static_assert(offsetof(FrameData, lightColor) == 160, "std140 offset of FrameData.lightColor");
+static_assert(sizeof(FrameData) == 176, "std140 size of FrameData");
+
+struct MaterialData {
+    glm::vec3 objectColor;
+    float pad0[1];
+};
+static_assert(offsetof(MaterialData, objectColor) == 0, "std140 offset of MaterialData.objectColor");
+static_assert(sizeof(MaterialData) == 16, "std140 size of MaterialData");
+
+// default-block uniforms, set with Shader::set
+namespace uniforms {
+    // cull_compute.glsl
+    constexpr Uniform<bool> compact("compact");
+    // vt_feedback_fragment.glsl
+    constexpr Uniform<float> feedbackBias("feedbackBias");
+    // cull_compute.glsl
+    constexpr Uniform<glm::vec4, 6> frustumPlanes("frustumPlanes");
+    // bench_normal_vertex.glsl, cont_vertex.glsl, depth_vertex.glsl, light_vertex.glsl
+    constexpr Uniform<glm::mat4> model("model");
+    // cont_fragment.glsl
+    constexpr Uniform<int> myTexture("myTexture");
+    // cont_fragment.glsl
+    constexpr Uniform<int> myTextureArray("myTextureArray");
+    // cont_vertex.glsl
+    constexpr Uniform<glm::mat3> normalMatrix("normalMatrix");
+    // cull_compute.glsl
+    constexpr Uniform<unsigned int> objectCount("objectCount");
+    // cont_fragment.glsl, vt_feedback_fragment.glsl
+    constexpr Uniform<int> pageCache("pageCache");
+    // cont_fragment.glsl, vt_feedback_fragment.glsl
+    constexpr Uniform<int> pageTable("pageTable");
+    // cull_compute.glsl
+    constexpr Uniform<bool> useMask("useMask");
+    // vt_feedback_fragment.glsl
+    constexpr Uniform<unsigned int> virtualTextureId("virtualTextureId");
+}
+#endif
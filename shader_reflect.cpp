@@ -0,0 +1,413 @@
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ShaderFeatures.h"
+#include "UniformHash.h"
+
+// Reads the project's GLSL and generates a header with a C++ struct for every
+// std140 uniform block (offsets checked with static_assert) and a typed slot
+// for every default-block uniform, so a misspelled name or a wrong value type
+// is a compile error instead of a silent -1 location. When glslangValidator
+// is on the PATH each stage is also validated in every feature permutation
+// ShaderVariants can build from it.
+// usage: shader_reflect output.h shaders/a.glsl shaders/b.glsl ...
+
+struct GlslType {
+    const char* cpp;
+    int size;   // std140 size in bytes
+    int align;  // std140 base alignment
+};
+
+static const std::map<std::string, GlslType> TYPES = {
+    { "float",     { "float",        4,  4 } },
+    { "int",       { "int",          4,  4 } },
+    { "uint",      { "unsigned int", 4,  4 } },
+    { "bool",      { "bool",         4,  4 } },
+    { "vec2",      { "glm::vec2",    8,  8 } },
+    { "vec3",      { "glm::vec3",    12, 16 } },
+    { "vec4",      { "glm::vec4",    16, 16 } },
+    { "mat3",      { "glm::mat3",    0,  0 } },  // not allowed in blocks, std140 pads its columns
+    { "mat4",      { "glm::mat4",    64, 16 } },
+    // samplers are set to a texture unit
+    { "sampler2D",      { "int", 0, 0 } },
+    { "sampler2DArray", { "int", 0, 0 } },
+    { "usampler2D",     { "int", 0, 0 } },
+};
+
+struct Member {
+    std::string type;
+    std::string name;
+    int count;  // 1 unless declared as an array
+};
+
+struct Block {
+    std::string name;
+    std::vector<Member> members;
+    std::string firstFile;
+};
+
+struct Uniform {
+    Member member;
+    std::vector<std::string> files;
+};
+
+static std::string normalize(std::string path)
+{
+    while(path.compare(0, 2, "./") == 0) path.erase(0, 2);
+    return path;
+}
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    out = stream.str();
+    return true;
+}
+
+static std::string baseName(const std::string& path)
+{
+    return path.substr(path.find_last_of('/') + 1);
+}
+
+// same rules as Shader::preprocess: includes relative to the includer, each once
+static std::string expandIncludes(const std::string& path, std::set<std::string>& included)
+{
+    included.insert(path);
+    std::string source;
+    if(!readFile(path, source)) {
+        std::cerr << "Failed to read " << path << std::endl;
+        exit(1);
+    }
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+
+    std::istringstream lines(source);
+    std::string line, code;
+    while(std::getline(lines, line)) {
+        std::istringstream words(line);
+        std::string directive;
+        words >> directive;
+        if(directive == "#include") {
+            size_t open = line.find('"');
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            std::string file = directory + line.substr(open + 1, close - open - 1);
+            if(!included.count(file)) code += expandIncludes(file, included);
+            continue;
+        }
+        code += line + "\n";
+    }
+    return code;
+}
+
+static std::vector<std::string> tokenize(const std::string& code)
+{
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while(i < code.size()) {
+        char c = code[i];
+        if(code.compare(i, 2, "//") == 0 || c == '#') {
+            // comments and preprocessor lines carry no declarations
+            i = code.find('\n', i);
+            if(i == std::string::npos) break;
+        } else if(code.compare(i, 2, "/*") == 0) {
+            i = code.find("*/", i);
+            if(i == std::string::npos) break;
+            i += 2;
+        } else if(isalnum((unsigned char)c) || c == '_') {
+            size_t start = i;
+            while(i < code.size() && (isalnum((unsigned char)code[i]) || code[i] == '_')) i++;
+            tokens.push_back(code.substr(start, i - start));
+        } else {
+            if(!isspace((unsigned char)c)) tokens.push_back(std::string(1, c));
+            i++;
+        }
+    }
+    return tokens;
+}
+
+// "type name[N], name2;" starting at tokens[i], leaves i after the ';'
+static std::vector<Member> parseDeclaration(const std::vector<std::string>& tokens, size_t& i)
+{
+    std::vector<Member> members;
+    std::string type = tokens[i++];
+    while(i < tokens.size()) {
+        Member member{ type, tokens[i++], 1 };
+        if(i < tokens.size() && tokens[i] == "[") {
+            member.count = atoi(tokens[i + 1].c_str());
+            i += 3;
+        }
+        members.push_back(member);
+        if(i >= tokens.size() || tokens[i++] == ";") break;
+    }
+    return members;
+}
+
+static void reflect(const std::string& path, std::map<std::string, Block>& blocks, std::map<std::string, Uniform>& uniforms)
+{
+    std::set<std::string> included;
+    std::vector<std::string> tokens = tokenize(expandIncludes(path, included));
+
+    for(size_t i = 0; i < tokens.size(); i++) {
+        if(tokens[i] != "uniform") continue;
+        i++;
+        // "uniform Name {" starts a block
+        if(i + 1 < tokens.size() && tokens[i + 1] == "{") {
+            Block block{ tokens[i], {}, path };
+            i += 2;
+            while(i < tokens.size() && tokens[i] != "}") {
+                for(Member& m : parseDeclaration(tokens, i)) block.members.push_back(m);
+            }
+            auto existing = blocks.find(block.name);
+            if(existing == blocks.end()) {
+                blocks[block.name] = block;
+            } else {
+                bool same = existing->second.members.size() == block.members.size();
+                for(size_t m = 0; same && m < block.members.size(); m++) {
+                    const Member& a = existing->second.members[m];
+                    const Member& b = block.members[m];
+                    same = a.type == b.type && a.name == b.name && a.count == b.count;
+                }
+                if(!same) {
+                    std::cerr << path << ": block " << block.name << " differs from " << existing->second.firstFile << std::endl;
+                    exit(1);
+                }
+            }
+            continue;
+        }
+
+        size_t start = i;
+        for(Member& m : parseDeclaration(tokens, i)) {
+            if(!TYPES.count(m.type)) {
+                std::cerr << path << ": unsupported uniform type " << m.type << " " << m.name << std::endl;
+                exit(1);
+            }
+            Uniform& u = uniforms[m.name];
+            if(!u.files.empty() && (u.member.type != m.type || u.member.count != m.count)) {
+                std::cerr << path << ": uniform " << m.name << " declared as " << m.type
+                          << " but as " << u.member.type << " in " << u.files[0] << std::endl;
+                exit(1);
+            }
+            u.member = m;
+            if(u.files.empty() || u.files.back() != baseName(path)) u.files.push_back(baseName(path));
+        }
+        i = i > start ? i - 1 : start;
+    }
+}
+
+static void writeBlock(std::ostream& out, const Block& block)
+{
+    std::ostringstream asserts;
+    out << "struct " << block.name << " {\n";
+    int offset = 0, padding = 0;
+    for(const Member& m : block.members) {
+        auto type = TYPES.find(m.type);
+        bool array = m.count > 1;
+        if(type == TYPES.end() || type->second.size == 0 || (array && m.type != "vec4" && m.type != "mat4")) {
+            // std140 rounds array strides and mat3 columns up to 16 bytes, glm doesn't
+            std::cerr << block.firstFile << ": " << block.name << "." << m.name
+                      << " has no std140-compatible C++ type" << std::endl;
+            exit(1);
+        }
+        int align = type->second.align;
+        int aligned = (offset + align - 1) / align * align;
+        if(aligned > offset) {
+            out << "    float pad" << padding++ << "[" << (aligned - offset) / 4 << "];\n";
+        }
+        offset = aligned;
+        out << "    " << type->second.cpp << " " << m.name;
+        if(array) out << "[" << m.count << "]";
+        out << ";\n";
+        asserts << "static_assert(offsetof(" << block.name << ", " << m.name << ") == " << offset
+                << ", \"std140 offset of " << block.name << "." << m.name << "\");\n";
+        offset += type->second.size * m.count;
+    }
+    // std140 rounds the block size up to a vec4
+    int size = (offset + 15) / 16 * 16;
+    if(size > offset) out << "    float pad" << padding++ << "[" << (size - offset) / 4 << "];\n";
+    out << "};\n";
+    out << asserts.str();
+    out << "static_assert(sizeof(" << block.name << ") == " << size << ", \"std140 size of " << block.name << "\");\n\n";
+}
+
+static bool haveValidator()
+{
+    return system("command -v glslangValidator > /dev/null 2>&1") == 0;
+}
+
+// validates one stage with the given #defines inserted after #version
+static bool validate(const std::string& path, const std::string& stage, const std::set<std::string>& defines)
+{
+    std::set<std::string> included;
+    std::string code = expandIncludes(path, included);
+    std::string header;
+    for(const std::string& name : defines) header += "#define " + name + "\n";
+    size_t version = code.find("#version");
+    size_t at = version == std::string::npos ? 0 : code.find('\n', version) + 1;
+    code.insert(at, header);
+
+    // unique names, several runs may validate at once
+    char source[] = "/tmp/shader_reflect.XXXXXX";
+    char log[] = "/tmp/shader_reflect.log.XXXXXX";
+    int sourceFd = mkstemp(source);
+    int logFd = sourceFd < 0 ? -1 : mkstemp(log);
+    if(sourceFd < 0 || logFd < 0) {
+        std::cerr << "Failed to create a temporary file for " << path << std::endl;
+        if(sourceFd >= 0) {
+            close(sourceFd);
+            unlink(source);
+        }
+        return false;
+    }
+    bool written = write(sourceFd, code.data(), code.size()) == (ssize_t)code.size();
+    close(sourceFd);
+    close(logFd);
+
+    std::string command = "glslangValidator -S " + stage + " " + source + " > " + log + " 2>&1";
+    bool ok = written && system(command.c_str()) == 0;
+    if(!ok) {
+        std::cerr << path << " failed validation";
+        for(const std::string& name : defines) std::cerr << " -D" << name;
+        std::cerr << ":" << std::endl;
+        std::ifstream output(log);
+        std::cerr << output.rdbuf();
+    }
+    unlink(source);
+    unlink(log);
+    return ok;
+}
+
+static std::string stageOf(const std::string& path)
+{
+    if(path.find("_vertex.glsl") != std::string::npos) return "vert";
+    if(path.find("_fragment.glsl") != std::string::npos) return "frag";
+    if(path.find("_compute.glsl") != std::string::npos) return "comp";
+    return "";  // an include, checked as part of its includers
+}
+
+// same rules as embed_shaders: #ifdef, #ifndef and defined() in #if/#elif
+static std::set<std::string> testedDefines(const std::string& path)
+{
+    std::set<std::string> included, names;
+    std::istringstream lines(expandIncludes(path, included));
+    std::string line;
+    while(std::getline(lines, line)) {
+        std::istringstream words(line);
+        std::string directive, name;
+        words >> directive;
+        if((directive == "#ifdef" || directive == "#ifndef") && words >> name) {
+            names.insert(name);
+        } else if(directive == "#if" || directive == "#elif") {
+            for(size_t at = line.find("defined"); at != std::string::npos; at = line.find("defined", at + 7)) {
+                size_t start = line.find_first_not_of(" (", at + 7);
+                size_t end = line.find_first_of(" )", start);
+                if(start != std::string::npos) names.insert(line.substr(start, end - start));
+            }
+        }
+    }
+    return names;
+}
+
+// ShaderVariants drops features a stage doesn't test, so each subset of the
+// ones it does test is a distinct program source
+static std::vector<std::set<std::string>> permutations(const std::string& path)
+{
+    std::set<std::string> tested = testedDefines(path);
+    std::vector<std::string> features;
+    for(int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+        if(tested.count(SHADER_FEATURE_NAMES[i])) features.push_back(SHADER_FEATURE_NAMES[i]);
+    }
+    std::vector<std::set<std::string>> result;
+    for(uint32_t mask = 0; mask < (1u << features.size()); mask++) {
+        std::set<std::string> defines;
+        for(size_t i = 0; i < features.size(); i++) {
+            if(mask & (1u << i)) defines.insert(features[i]);
+        }
+        result.push_back(defines);
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2) {
+        std::cerr << "usage: shader_reflect output.h shader.glsl..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    for(int i = 2; i < argc; i++) files.push_back(normalize(argv[i]));
+
+    if(haveValidator()) {
+        bool ok = true;
+        for(const std::string& path : files) {
+            std::string stage = stageOf(path);
+            if(stage.empty()) continue;
+            for(const std::set<std::string>& defines : permutations(path)) ok = validate(path, stage, defines) && ok;
+        }
+        if(!ok) return 1;
+    } else {
+        std::cout << "glslangValidator not found, skipping validation" << std::endl;
+    }
+
+    std::map<std::string, Block> blocks;
+    std::map<std::string, Uniform> uniforms;
+    for(const std::string& path : files) {
+        if(stageOf(path).empty()) continue;
+        reflect(path, blocks, uniforms);
+    }
+
+    // Shader finds locations by name hash, so two names sharing one can't both be set
+    std::map<uint32_t, std::string> hashes;
+    for(auto& entry : uniforms) {
+        uint32_t hash = uniformHash(entry.first.c_str());
+        auto seen = hashes.find(hash);
+        if(hash == 0 || seen != hashes.end()) {
+            std::cerr << "uniform " << entry.first << " has the same name hash as "
+                      << (hash == 0 ? "an empty slot" : seen->second) << ", rename one of them" << std::endl;
+            return 1;
+        }
+        hashes[hash] = entry.first;
+    }
+
+    std::ostringstream out;
+    out << "// generated by shader_reflect from shaders/*.glsl, do not edit\n"
+        << "#ifndef SHADER_LAYOUTS_H\n"
+        << "#define SHADER_LAYOUTS_H\n\n"
+        << "#include <cstddef>\n"
+        << "#include <glm/glm.hpp>\n"
+        << "#include \"Uniforms.h\"\n\n"
+        << "// std140 uniform blocks\n";
+    for(auto& entry : blocks) writeBlock(out, entry.second);
+
+    out << "// default-block uniforms, set with Shader::set\n"
+        << "namespace uniforms {\n";
+    for(auto& entry : uniforms) {
+        const Uniform& u = entry.second;
+        out << "    // ";
+        for(size_t i = 0; i < u.files.size(); i++) out << (i ? ", " : "") << u.files[i];
+        out << "\n    constexpr Uniform<" << TYPES.at(u.member.type).cpp;
+        if(u.member.count > 1) out << ", " << u.member.count;
+        out << "> " << u.member.name << "(\"" << u.member.name << "\");\n";
+    }
+    out << "}\n#endif\n";
+
+    // leave the file alone when nothing changed so make doesn't rebuild
+    std::string previous;
+    if(readFile(argv[1], previous) && previous == out.str()) return 0;
+    std::ofstream file(argv[1]);
+    file << out.str();
+    if(!file) {
+        std::cerr << "Failed to write " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << argv[1] << ": " << blocks.size() << " blocks, " << uniforms.size() << " uniforms" << std::endl;
+    return 0;
+}
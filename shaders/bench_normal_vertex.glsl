@@ -0,0 +1,24 @@
+#version 330 core
+// benchmarkSphere's baseline only: cont_vertex.glsl with the normal matrix
+// inverted per vertex, as it was before the normalMatrix uniform
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+
+#include "frame_data.glsl"
+
+uniform mat4 model;
+
+invariant gl_Position;
+
+void main()
+{
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+    TexCoord = aTexCoord;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
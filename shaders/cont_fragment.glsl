@@ -1,22 +1,33 @@
 #version 330 core
+// features: PHONG, TEXTURED, TEXTURE_ARRAY, VIRTUAL_TEXTURE (see ShaderVariants.h)
 out vec4 FragColor;
 
 in vec2 TexCoord;
 in vec3 Normal;  
 in vec3 FragPos;  
 
-  
-uniform bool phong;
+#include "frame_data.glsl"
 
-uniform vec3 lightPos; 
-uniform vec3 lightColor;
-uniform vec3 objectColor;
-uniform vec3 viewPos;
+#include "material_data.glsl"
 
+#ifdef TEXTURED
+#ifdef TEXTURE_ARRAY
+// every wall's texture is a layer of one array, so they all draw in one call
+flat in float Layer;
+uniform sampler2DArray myTextureArray;
+#else
 uniform sampler2D myTexture;
+#endif
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// one unique texture over the whole surface, paged in as needed
+#include "virtual_texture.glsl"
+#endif
 
 void main()
 {
+#ifdef PHONG
     vec3 normal1 = Normal;
     float lightDot = dot(lightPos - FragPos, Normal);
     if(lightDot < 0)
@@ -42,5 +53,17 @@ void main()
             
     float dist = length(FragPos - lightPos);
     vec3 result = (ambient + diffuse + specular) * objectColor / (dist / 5);
-    FragColor = texture(myTexture, TexCoord) * vec4(phong ? result : objectColor, 1.0);
+#else
+    vec3 result = objectColor;
+#endif
+
+#if defined(VIRTUAL_TEXTURE)
+    FragColor = virtualTexture(TexCoord) * vec4(result, 1.0);
+#elif defined(TEXTURED) && defined(TEXTURE_ARRAY)
+    FragColor = texture(myTextureArray, vec3(TexCoord, Layer)) * vec4(result, 1.0);
+#elif defined(TEXTURED)
+    FragColor = texture(myTexture, TexCoord) * vec4(result, 1.0);
+#else
+    FragColor = vec4(result, 1.0);
+#endif
 } 
@@ -2,19 +2,33 @@
 layout (location = 0) in vec3 aPos;   // the position variable has attribute position 0
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+#ifdef TEXTURE_ARRAY
+layout (location = 3) in float aLayer;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
+#ifdef TEXTURE_ARRAY
+flat out float Layer;
+#endif
+
+#include "frame_data.glsl"
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// transpose(inverse(mat3(model))), computed once per object on the CPU
+uniform mat3 normalMatrix;
+
+// the depth pre-pass (depth_vertex.glsl) has to produce identical depths
+invariant gl_Position;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * aNormal;
     TexCoord = aTexCoord;
-    gl_Position = projection * view * vec4(aPos, 1.0);
+#ifdef TEXTURE_ARRAY
+    Layer = aLayer;
+#endif
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }   
@@ -0,0 +1,51 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int  baseVertex;
+    uint baseInstance;
+};
+
+// two vec4s per object: center.xyz, extents.xyz
+layout (std430, binding = 0) readonly buffer Bounds { vec4 bounds[]; };
+layout (std430, binding = 1) readonly buffer Commands { DrawCommand commands[]; };
+layout (std430, binding = 2) writeonly buffer Visible { DrawCommand visible[]; };
+layout (std430, binding = 3) buffer DrawCount { uint drawCount; };
+// one bit per object, coarse visibility from the CPU (e.g. a PVS row)
+layout (std430, binding = 4) readonly buffer VisibilityMask { uint mask[]; };
+
+uniform vec4 frustumPlanes[6];
+uniform uint objectCount;
+uniform bool useMask;
+// append survivors and count them, or keep every slot and zero instanceCount
+uniform bool compact;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if(i >= objectCount)
+        return;
+
+    bool inside = !useMask || (mask[i >> 5] & (1u << (i & 31u))) != 0u;
+
+    vec3 center = bounds[i * 2].xyz;
+    vec3 extents = bounds[i * 2 + 1].xyz;
+    for(int p = 0; p < 6 && inside; p++) {
+        vec4 plane = frustumPlanes[p];
+        float reach = dot(abs(plane.xyz), extents);
+        if(dot(plane.xyz, center) + plane.w < -reach)
+            inside = false;
+    }
+
+    if(compact) {
+        if(inside)
+            visible[atomicAdd(drawCount, 1u)] = commands[i];
+    } else {
+        DrawCommand command = commands[i];
+        command.instanceCount = inside ? 1u : 0u;
+        visible[i] = command;
+    }
+}
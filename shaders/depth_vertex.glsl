@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+#include "frame_data.glsl"
+
+uniform mat4 model;
+
+// must match cont_vertex.glsl bit for bit, the lighting pass tests GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
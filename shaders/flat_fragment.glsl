@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+#include "material_data.glsl"
+
+void main()
+{
+    FragColor = vec4(objectColor, 1.0);
+}
@@ -0,0 +1,8 @@
+// per-frame block shared by every program, FrameData in the generated shader_layouts.h
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    vec3 lightPos;
+    vec3 lightColor;
+};
@@ -1,11 +1,15 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;   // the position variable has attribute position 0
   
+#include "frame_data.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// also drawn after the depth pre-pass, same expression as depth_vertex.glsl
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }   
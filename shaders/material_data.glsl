@@ -0,0 +1,4 @@
+// per-material block, MaterialData in the generated shader_layouts.h
+layout (std140) uniform MaterialData {
+    vec3 objectColor;
+};
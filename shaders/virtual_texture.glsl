@@ -0,0 +1,47 @@
+// virtual texture lookups, see VirtualTextures.h; sizes mirror VirtualTextureFile.h
+const float VT_PAGE_SIZE = 128.0;
+const float VT_BORDER = 4.0;
+
+// a texel per page, a mip per level: cache slot x, y, the level in that slot, 255 once mapped
+uniform sampler2D pageTable;
+uniform sampler2D pageCache;
+
+// the level the pixel's footprint asks for, bias in levels
+int virtualLevel(vec2 uv, float bias)
+{
+    vec2 pages = vec2(textureSize(pageTable, 0));
+    vec2 texels = uv * pages * VT_PAGE_SIZE;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float level = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + bias;
+    int coarsest = int(log2(max(pages.x, pages.y)));
+    return clamp(int(max(level, 0.0)), 0, coarsest);
+}
+
+// page at the wanted level: x | y << 10 | level << 20 | texture << 24
+uint virtualFeedback(vec2 uv, float bias, uint textureId)
+{
+    uv = clamp(uv, 0.0, 1.0);
+    int level = virtualLevel(uv, bias);
+    ivec2 pages = textureSize(pageTable, level);
+    ivec2 page = min(ivec2(uv * vec2(pages)), pages - 1);
+    return uint(page.x) | (uint(page.y) << 10) | (uint(level) << 20) | (textureId << 24);
+}
+
+// bilinear from the finest resident page; levels switch without blending
+vec4 virtualTexture(vec2 uv)
+{
+    uv = clamp(uv, 0.0, 1.0);
+    int level = virtualLevel(uv, 0.0);
+    ivec2 pages = textureSize(pageTable, level);
+    vec4 entry = texelFetch(pageTable, min(ivec2(uv * vec2(pages)), pages - 1), level) * 255.0;
+    // nothing loaded yet
+    if(entry.a < 0.5) return vec4(0.5, 0.5, 0.5, 1.0);
+
+    // texel position in the level the slot holds, which may be coarser than wanted
+    vec2 size = max(vec2(textureSize(pageTable, 0)) * VT_PAGE_SIZE / exp2(floor(entry.b + 0.5)), vec2(1.0));
+    vec2 texel = min(uv * size, size - 0.001);
+    vec2 inPage = texel - floor(texel / VT_PAGE_SIZE) * VT_PAGE_SIZE;
+    vec2 cacheTexel = floor(entry.rg + 0.5) * (VT_PAGE_SIZE + 2.0 * VT_BORDER) + VT_BORDER + inPage;
+    return textureLod(pageCache, cacheTexel / vec2(textureSize(pageCache, 0)), 0.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// the virtual texture page each pixel needs, read back by VirtualTextures
+layout (location = 0) out uint Feedback;
+
+in vec2 TexCoord;
+
+#include "virtual_texture.glsl"
+
+uniform uint virtualTextureId;
+// the target is smaller than the screen, this brings the level back to what the screen needs
+uniform float feedbackBias;
+
+void main()
+{
+    Feedback = virtualFeedback(TexCoord, feedbackBias, virtualTextureId);
+}
@@ -0,0 +1,318 @@
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "ImageDecoder.h"
+#include "KTX2.h"
+#include "MipGenerator.h"
+#include "TextureCache.h"
+#include "TextureImage.h"
+#include "VirtualTextureFile.h"
+
+// after ImageDecoder.h, which includes the header part
+#if defined(__ARM_NEON)
+#define STBI_NEON
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// Offline texture utilities, no GL context needed.
+// usage: texture_tool bench-cache image...
+//        texture_tool cook image output.ktx2
+//        texture_tool bench-mips image
+//        texture_tool bench-decode [directory|image]...
+//        texture_tool vtex image output.vtex [repeatX repeatY]
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static bool readFile(const std::string& path, std::vector<char>& out)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !out.empty();
+}
+
+// cold: decode + mip chain + store, warm: map the cache entry and touch every page
+static int benchCache(int count, char** paths)
+{
+    const int RUNS = 5;
+    double coldTotal = 0.0, warmTotal = 0.0;
+    for(int i = 0; i < count; i++) {
+        std::vector<char> bytes;
+        if(!readFile(paths[i], bytes)) {
+            std::cerr << "cannot read " << paths[i] << std::endl;
+            return 1;
+        }
+        uint64_t key = TextureCache::key(bytes.data(), bytes.size());
+
+        double cold = 1e30;
+        std::unique_ptr<TextureImage> decoded;
+        for(int run = 0; run < RUNS; run++) {
+            auto start = std::chrono::steady_clock::now();
+            DecodedImage image;
+            std::string error;
+            if(!decodeImage(bytes.data(), bytes.size(), TextureImage::channels(FORMAT_RGBA8), image, error)) {
+                std::cerr << paths[i] << ": " << error << std::endl;
+                return 1;
+            }
+            decoded = MipGenerator().build(image.pixels.data(), image.width, image.height, FORMAT_RGBA8);
+            cold = std::min(cold, millisecondsSince(start));
+        }
+        textureCache().store(key, *decoded);
+
+        double warm = 1e30;
+        // volatile so the page walk isn't optimized away
+        volatile unsigned checksum = 0;
+        for(int run = 0; run < RUNS; run++) {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<TextureImage> mapped = textureCache().load(key);
+            if(!mapped) {
+                std::cerr << paths[i] << ": cache entry unreadable" << std::endl;
+                return 1;
+            }
+            // fault the pages in, the upload would read all of them anyway
+            for(size_t offset = 0; offset < mapped->size; offset += 4096) checksum += mapped->data[offset];
+            warm = std::min(warm, millisecondsSince(start));
+            if(mapped->size != decoded->size || memcmp(mapped->data, decoded->data, decoded->size) != 0) {
+                std::cerr << paths[i] << ": cache entry differs from the decode" << std::endl;
+                return 1;
+            }
+        }
+
+        std::cout << paths[i] << " " << decoded->width << "x" << decoded->height << ", "
+                  << decoded->levels << " levels: decode " << cold << " ms, cached " << warm << " ms ("
+                  << cold / warm << "x)" << std::endl;
+        coldTotal += cold;
+        warmTotal += warm;
+    }
+    std::cout << "total: decode " << coldTotal << " ms, cached " << warmTotal << " ms" << std::endl;
+    return 0;
+}
+
+static double psnr(const TextureImage& a, const TextureImage& b)
+{
+    int channels = TextureImage::channels(a.format);
+    size_t count = (size_t)a.width * a.height * channels;
+    double squared = 0.0;
+    for(size_t i = 0; i < count; i++) {
+        double d = (double)a.data[i] - b.data[i];
+        squared += d * d;
+    }
+    if(squared == 0.0) return 99.0;
+    return 10.0 * log10(255.0 * 255.0 / (squared / count));
+}
+
+static bool loadImage(const char* path, int channels, DecodedImage& image)
+{
+    std::vector<char> bytes;
+    std::string error = "cannot read file";
+    if(!readFile(path, bytes) || !decodeImage(bytes.data(), bytes.size(), channels, image, error)) {
+        std::cerr << path << ": " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// BC3 when any texel is translucent, BC1 otherwise; checked by decoding it back
+static int cook(const char* inPath, const char* outPath)
+{
+    DecodedImage image;
+    if(!loadImage(inPath, 4, image)) return 1;
+    int width = image.width, height = image.height;
+    unsigned char* pixels = image.pixels.data();
+    bool alpha = false;
+    for(size_t i = 0; i < (size_t)width * height && !alpha; i++) alpha = pixels[i * 4 + 3] != 255;
+    if(!alpha) {
+        for(size_t i = 0; i < (size_t)width * height; i++) memmove(pixels + i * 3, pixels + i * 4, 3);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<TextureImage> source = MipGenerator().build(pixels, width, height, alpha ? FORMAT_RGBA8 : FORMAT_RGB8);
+    std::unique_ptr<TextureImage> compressed = compressImage(*source, alpha ? FORMAT_BC3 : FORMAT_BC1);
+    double milliseconds = millisecondsSince(start);
+    if(!KTX2::write(outPath, *compressed)) return 1;
+
+    // what the GPU would hold for the uncompressed chain, RGB is padded to RGBA
+    size_t uncompressed = TextureImage::chainSize(FORMAT_RGBA8, width, height);
+    std::unique_ptr<TextureImage> decoded = decompressImage(*compressed);
+    std::cout << outPath << ": " << (alpha ? "BC3" : "BC1") << " " << width << "x" << height << ", "
+              << compressed->levels << " levels, " << compressed->size / 1024 << " KB (RGBA8 "
+              << uncompressed / 1024 << " KB, " << (double)uncompressed / compressed->size << "x smaller), "
+              << "PSNR " << psnr(*source, *decoded) << " dB, " << milliseconds << " ms" << std::endl;
+    return 0;
+}
+
+// the image repeated into one large surface, sized up to powers of two, paged for VirtualTextures
+static int vtex(const char* inPath, const char* outPath, int repeatX, int repeatY)
+{
+    DecodedImage image;
+    if(!loadImage(inPath, 4, image)) return 1;
+    if(repeatX < 1 || repeatY < 1) {
+        std::cerr << "repeat counts must be at least 1" << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int mosaicWidth = image.width * repeatX, mosaicHeight = image.height * repeatY;
+    std::vector<unsigned char> mosaic((size_t)mosaicWidth * mosaicHeight * 4);
+    for(int y = 0; y < mosaicHeight; y++) {
+        for(int tile = 0; tile < repeatX; tile++) {
+            memcpy(&mosaic[((size_t)y * mosaicWidth + (size_t)tile * image.width) * 4],
+                   &image.pixels[(size_t)(y % image.height) * image.width * 4], (size_t)image.width * 4);
+        }
+    }
+
+    int width = VirtualTextureFile::PAGE_SIZE, height = VirtualTextureFile::PAGE_SIZE;
+    while(width < mosaicWidth) width *= 2;
+    while(height < mosaicHeight) height *= 2;
+    if(width != mosaicWidth || height != mosaicHeight) {
+        mosaic = MipGenerator::resize(mosaic.data(), mosaicWidth, mosaicHeight, 4, width, height, 4);
+    }
+    std::unique_ptr<TextureImage> chain = MipGenerator().build(mosaic.data(), width, height, FORMAT_RGBA8);
+    if(!VirtualTextureFile::write(outPath, *chain)) return 1;
+
+    VirtualTextureFile file;
+    if(!file.open(outPath)) return 1;
+    size_t pages = 0;
+    for(int level = 0; level < file.levels; level++) pages += (size_t)file.pagesX(level) * file.pagesY(level);
+    std::cout << outPath << ": " << width << "x" << height << ", " << file.levels << " levels, " << pages
+              << " pages, " << pages * file.pageBytes() / 1024 << " KB, " << millisecondsSince(start) << " ms"
+              << std::endl;
+    return 0;
+}
+
+// every filter, single threaded and on all cores
+static int benchMips(const char* path)
+{
+    DecodedImage image;
+    if(!loadImage(path, 3, image)) return 1;
+    const int RUNS = 5;
+    for(MipFilter filter : { MIP_BOX, MIP_KAISER }) {
+        for(int threads : { 1, 0 }) {
+            MipGenerator generator;
+            generator.filter = filter;
+            generator.threads = threads;
+            double best = 1e30;
+            for(int run = 0; run < RUNS; run++) {
+                auto start = std::chrono::steady_clock::now();
+                generator.build(image.pixels.data(), image.width, image.height);
+                best = std::min(best, millisecondsSince(start));
+            }
+            std::cout << (filter == MIP_BOX ? "box    " : "kaiser ") << (threads == 1 ? "1 thread:  " : "all cores: ")
+                      << best << " ms" << std::endl;
+        }
+    }
+    return 0;
+}
+
+static void listImages(const std::string& path, std::vector<std::string>& out)
+{
+    DIR* directory = opendir(path.c_str());
+    if(!directory) {
+        out.push_back(path);
+        return;
+    }
+    std::vector<std::string> names;
+    while(dirent* entry = readdir(directory)) {
+        std::string name = entry->d_name;
+        size_t dot = name.find_last_of('.');
+        std::string extension = dot == std::string::npos ? "" : name.substr(dot + 1);
+        if(extension == "jpg" || extension == "jpeg" || extension == "png") names.push_back(path + "/" + name);
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    out.insert(out.end(), names.begin(), names.end());
+}
+
+// every decoder that takes each image, RGB8 as the loader asks for; differences are against stb_image
+static int benchDecode(int count, char** paths)
+{
+    std::vector<std::string> images;
+    if(count == 0) listImages("textures", images);
+    for(int i = 0; i < count; i++) listImages(paths[i], images);
+
+    const int RUNS = 5;
+    const std::vector<const ImageDecoder*>& decoders = imageDecoders();
+    std::vector<double> totals(decoders.size(), 0.0);
+    std::vector<bool> tookAll(decoders.size(), true);
+    for(const std::string& path : images) {
+        std::vector<char> bytes;
+        if(!readFile(path, bytes)) {
+            std::cerr << "cannot read " << path << std::endl;
+            return 1;
+        }
+        const unsigned char* data = (const unsigned char*)bytes.data();
+        DecodedImage reference;
+        std::string error;
+        if(!decoders.back()->decode(data, bytes.size(), 3, reference, error)) {
+            std::cerr << path << ": " << error << std::endl;
+            return 1;
+        }
+        std::cout << path << " " << reference.width << "x" << reference.height << std::endl;
+
+        for(size_t d = 0; d < decoders.size(); d++) {
+            if(!decoders[d]->accepts(data, bytes.size())) {
+                tookAll[d] = false;
+                continue;
+            }
+            double best = 1e30;
+            DecodedImage image;
+            for(int run = 0; run < RUNS; run++) {
+                auto start = std::chrono::steady_clock::now();
+                if(!decoders[d]->decode(data, bytes.size(), 3, image, error)) break;
+                best = std::min(best, millisecondsSince(start));
+            }
+            if(best == 1e30) {
+                std::cout << "  " << decoders[d]->name() << ": failed, " << error << std::endl;
+                tookAll[d] = false;
+                continue;
+            }
+            int maxDifference = 0;
+            if(image.pixels.size() == reference.pixels.size()) {
+                for(size_t i = 0; i < image.pixels.size(); i++) {
+                    maxDifference = std::max(maxDifference, std::abs(image.pixels[i] - reference.pixels[i]));
+                }
+            } else {
+                maxDifference = 255;
+            }
+            double megapixels = (double)image.width * image.height / 1e6;
+            std::cout << "  " << decoders[d]->name() << ": " << best << " ms, " << megapixels / (best / 1000.0)
+                      << " MP/s, max difference " << maxDifference << std::endl;
+            totals[d] += best;
+        }
+    }
+    for(size_t d = 0; d < decoders.size(); d++) {
+        std::cout << decoders[d]->name() << " total: " << totals[d] << " ms"
+                  << (tookAll[d] ? "" : " (not every image)") << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 2 && strcmp(argv[1], "bench-cache") == 0) return benchCache(argc - 2, argv + 2);
+    if(argc == 4 && strcmp(argv[1], "cook") == 0) return cook(argv[2], argv[3]);
+    if(argc == 3 && strcmp(argv[1], "bench-mips") == 0) return benchMips(argv[2]);
+    if(argc >= 2 && strcmp(argv[1], "bench-decode") == 0) return benchDecode(argc - 2, argv + 2);
+    if(argc == 4 && strcmp(argv[1], "vtex") == 0) return vtex(argv[2], argv[3], 1, 1);
+    if(argc == 6 && strcmp(argv[1], "vtex") == 0) return vtex(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+
+    std::cerr << "usage: texture_tool bench-cache image..." << std::endl
+              << "       texture_tool cook image output.ktx2" << std::endl
+              << "       texture_tool bench-mips image" << std::endl
+              << "       texture_tool bench-decode [directory|image]..." << std::endl
+              << "       texture_tool vtex image output.vtex [repeatX repeatY]" << std::endl;
+    return 1;
+}